@@ -1,5 +1,6 @@
 ﻿#include "ApplicationController.h"
 #include <iostream>
+#include "Transforms.h"
 #ifdef _DEBUG
 #include "OpenGLProfiler.h"
 #endif
@@ -16,6 +17,8 @@ ApplicationController::ApplicationController() {
 	shapeArray = new DynamicShapeArray();
 	inputController = new InputController(camera, shapeArray);
 	renderer = new OpenGLRenderer();
+	physicsStep = PHYSICS_STEP;
+	maxPhysicsSteps = MAX_PHYSICS_STEPS;
 }
 ApplicationController::~ApplicationController() {
 	delete camera;
@@ -24,6 +27,15 @@ ApplicationController::~ApplicationController() {
 	delete renderer;
 }
 
+void ApplicationController::setGpuCulling(bool enabled) {
+	gpuCulling = enabled;
+}
+
+void ApplicationController::setPhysicsStep(float step, uint32_t maxStepsPerFrame) {
+	physicsStep = step > 0.f ? step : PHYSICS_STEP;
+	maxPhysicsSteps = maxStepsPerFrame > 0 ? maxStepsPerFrame : 1;
+}
+
 int ApplicationController::start() {
 	
 	uint32_t one = 1;
@@ -47,25 +59,25 @@ int ApplicationController::start() {
 
 	// Prototype objects are created so that new objects can be derived from them
 	shapeArray->InitFactoryPrototypes();
+	shapeArray->SetCollisionEventCapacity(); // drained after every physics step for the collision sound
 
 	// Quick uploading buffer for single object data
 	renderer->createUBO(0, MODEL_MATRIX, sizeof(objMatrices));
 	renderer->createUBO(1, OBJ_COLOR, sizeof(colorData));
 	renderer->createUBO(2, CAM_LIGHT_POSITIONS, sizeof(camLightPositions));
 	renderer->createUBO(3, IS_TEXTURE, 1 * sizeof(uint32_t));
+	renderer->createUBO(4, VIEW_PROJECTION, sizeof(glm::mat4)); // the batch shader builds every body's matrices from it
+	renderer->createUBO(5, CULL_PARAMS, sizeof(cullParams));
 
-	// Create 500 shape buffers to minimize resizing during runtime
-	// This is done for for batch rendering
-	renderer->createSSBO(0, CUBE_MATRICES, 500 * sizeof(objMatrices));  
-	renderer->createSSBO(0, SPHERE_MATRICES, 500 * sizeof(objMatrices));  
-	renderer->createSSBO(0, CYLINDER_MATRICES, 500 * sizeof(objMatrices));
-	renderer->createSSBO(0, RING_MATRICES, 500 * sizeof(objMatrices)); 
-
-	renderer->createSSBO(1, CUBE_COLORS, sizeof(glm::vec4));
-	renderer->createSSBO(1, SPHERE_COLORS, sizeof(glm::vec4));
-	renderer->createSSBO(1, CYLINDER_COLORS, sizeof(glm::vec4));
-	renderer->createSSBO(1, RING_COLORS, sizeof(glm::vec4));
-	void* ssboPtr;
+	// Create buffers for 2000 shapes to minimize resizing during runtime
+	// This is done for for batch rendering, with one InstanceData (center and scale) and one packed color per body.
+	// All shape types share the buffers, each one starting where the previous type ends.
+	renderer->createSSBO(0, BATCH_INSTANCES, 2000 * sizeof(InstanceData));
+	renderer->createSSBO(1, BATCH_COLORS, 2000 * sizeof(uint32_t));
+	// One draw command per shape type, drawn with a single multi draw. The culling pass fills their instance counts
+	// and the visible instance indices.
+	renderer->createIndirectBuffer(DRAW_COMMANDS, SHAPE_TYPE_COUNT * sizeof(DrawElementsIndirectCommand));
+	renderer->createSSBO(2, VISIBLE_INSTANCES, 2000 * sizeof(uint32_t));
 
 	// Create cube enclosure and sphere in the middle
 	shapeArray->CreateShape(0.0f, 0.0f, 0.0f, 100.0f, T_CUBE);
@@ -97,14 +109,14 @@ int ApplicationController::start() {
 	renderer->initShader("shaders/obj_shader.slang");
 	renderer->initShader("shaders/obj_tex_shader.slang");
 	renderer->initShader("shaders/batch_shader.slang"); 
+	renderer->initComputeShader("shaders/cull_shader.slang");
+	gpuCulling = gpuCulling && renderer->hasShader(CULL_SHADER); // falls back to CPU culling without compute shaders
 
 	// Helpers to profile the code
 #ifdef _DEBUG
 	OpenGLProfiler bufferUpdateProfiler("Buffer Updates");
-	OpenGLProfiler cubeDrawProfiler("Draw Cubes");
-	OpenGLProfiler sphereDrawProfiler("Draw Spheres");
-	OpenGLProfiler cylinderDrawProfiler("Draw Cylinders");
-	OpenGLProfiler ringDrawProfiler("Draw Rings");
+	OpenGLProfiler cullProfiler("Cull Batches");
+	OpenGLProfiler batchDrawProfiler("Draw Batches");
 #endif
 	uint32_t frameCount = 0;
 	uint32_t shapeArrSize;
@@ -119,6 +131,11 @@ int ApplicationController::start() {
 
 	// do trick with lastFrameTime so that physics don't go bonkers at start
 	float lastFrameTime = static_cast<float>(glfwGetTime()), currentFrameTime = 0.f, deltaTime = .016f;
+	// Physics always advances in steps of physicsStep, whatever the frame rate.
+	// The time left over is carried to the next frame and used to blend the last two physics states.
+	float accumulator = 0.f;
+	std::vector<CollisionEvent> collisionEvents;
+	uint64_t droppedEventSteps = 0;
 	while (inputController->parseInputs(window, deltaTime) != GLFW_PRESS && !glfwWindowShouldClose(window)) {
 #ifdef _WIN32
 		if (soundsEnabled)
@@ -141,8 +158,41 @@ int ApplicationController::start() {
 			l = (-1.0f) * l;
 		}
 
-		shapeArray->UpdatePhysics(deltaTime);
-		shapeArray->UpdateMatrices(camera->getView(), Projection);
+		accumulator += deltaTime;
+		uint32_t steps = 0;
+		collisionEvents.clear();
+		CollisionEventQueue& eventQueue = shapeArray->getCollisionEvents();
+		while (accumulator >= physicsStep && steps < maxPhysicsSteps) {
+			shapeArray->UpdatePhysics(physicsStep);
+			// the ring only has to hold one step this way, however many steps the frame runs
+			eventQueue.drain(collisionEvents);
+			accumulator -= physicsStep;
+			++steps;
+		}
+		if (eventQueue.getDroppedStepCount() > 0) {
+			// a single step had more hits than the ring holds. Nothing is queued after the drain,
+			// so the ring can grow here for the next ones.
+			droppedEventSteps += eventQueue.getDroppedStepCount();
+			shapeArray->SetCollisionEventCapacity(eventQueue.getCapacity() * 2);
+			std::cout << "Collision events: " << droppedEventSteps << " steps dropped so far, queue grown to "
+				<< eventQueue.getCapacity() << std::endl;
+		}
+		if (steps == maxPhysicsSteps && accumulator >= physicsStep) {
+			// Too slow to keep up, let the simulation fall behind instead of spiraling
+			accumulator = 0.f;
+		}
+#ifdef _WIN32
+		// Play sound on collision for the first 5 shapes only to avoid sound spam
+		for (const CollisionEvent& event : collisionEvents) {
+			if (event.bodyA <= 5 && soundsEnabled) {
+				PlaySound(TEXT("collision.wav"), NULL, SND_FILENAME | SND_ASYNC);
+				break;
+			}
+		}
+#endif
+		// Only the hero sphere needs matrices on the CPU, the batch shader builds the others from the instances
+		float alpha = accumulator / physicsStep;
+		shapeArray->UpdateHeroMatrices(camera->getView(), Projection);
 
 		// Sphere drawing process: Use shader with texture support -> upload camera position and light position to VRAM -> 
 		// Bind shape -> upload color and model matrix -> draw call -> unbind shader
@@ -164,68 +214,86 @@ int ApplicationController::start() {
 		bufferUpdateProfiler.begin();
 #endif
 		// This is the core of the batch rendering process
-		// Uploads for all objects of each shape type their matrices and colors to the mapped SSBO pointers
-		ssboPtr = renderer->getMappedSSBOData(CUBE_MATRICES, shapeArray->getShapeTypeArraySize(T_CUBE) * sizeof(objMatrices));
-		shapeArray->uploadMatricesToPtr(T_CUBE, CUBE_MATRICES, ssboPtr);
-		ssboPtr = renderer->getMappedSSBOData(SPHERE_MATRICES, shapeArray->getShapeTypeArraySize(T_SPHERE) * sizeof(objMatrices));
-		shapeArray->uploadMatricesToPtr(T_SPHERE, SPHERE_MATRICES, ssboPtr);
-		ssboPtr = renderer->getMappedSSBOData(CYLINDER_MATRICES, shapeArray->getShapeTypeArraySize(T_CYLINDER) * sizeof(objMatrices));
-		shapeArray->uploadMatricesToPtr(T_CYLINDER, CYLINDER_MATRICES, ssboPtr);
-		ssboPtr = renderer->getMappedSSBOData(RING_MATRICES, shapeArray->getShapeTypeArraySize(T_RING) * sizeof(objMatrices));
-		shapeArray->uploadMatricesToPtr(T_RING, RING_MATRICES, ssboPtr);
-
-		// TODO: only upload the new colours (super micro optimization since whole upload takes 0.000032ms)
-		ssboPtr = renderer->getMappedSSBOData(CUBE_COLORS, shapeArray->getShapeTypeArraySize(T_CUBE) * sizeof(glm::vec4));
-		shapeArray->uploadColorsToPtr(T_CUBE, CUBE_COLORS, ssboPtr);
-		ssboPtr = renderer->getMappedSSBOData(SPHERE_COLORS, shapeArray->getShapeTypeArraySize(T_SPHERE) * sizeof(glm::vec4));
-		shapeArray->uploadColorsToPtr(T_SPHERE, SPHERE_COLORS, ssboPtr);
-		ssboPtr = renderer->getMappedSSBOData(CYLINDER_COLORS, shapeArray->getShapeTypeArraySize(T_CYLINDER) * sizeof(glm::vec4));
-		shapeArray->uploadColorsToPtr(T_CYLINDER, CYLINDER_COLORS, ssboPtr);
-		ssboPtr = renderer->getMappedSSBOData(RING_COLORS, shapeArray->getShapeTypeArraySize(T_RING) * sizeof(glm::vec4));
-		shapeArray->uploadColorsToPtr(T_RING, RING_COLORS, ssboPtr);
+		// Uploads for all objects of each shape type their instances and colors to the mapped SSBO pointers,
+		// and one draw command per shape type that points its instances at the type's range.
+		// With GPU culling the instance counts start at zero and the culling pass adds the visible instances.
+		// Without it the bodies are culled on the CPU first and only the visible ones are uploaded, compacted.
+		glm::mat4 viewProjection = Projection * camera->getView();
+		cullParams cull{};
+		Transforms::FrustumPlanes(viewProjection, cull.planes);
+		for (int shapeType = T_CUBE; shapeType < SHAPE_TYPE_COUNT; ++shapeType) {
+			cull.typeRadius[shapeType] = renderer->getMeshRadius(shapeType);
+		}
+		if (!gpuCulling) {
+			shapeArray->CullBodies(cull.planes, cull.typeRadius, alpha);
+		}
+		uint64_t batchSize = 0;
+		for (int shapeType = T_CUBE; shapeType < SHAPE_TYPE_COUNT; ++shapeType) {
+			batchSize += gpuCulling ? shapeArray->getShapeTypeArraySize(shapeType) : shapeArray->getVisibleCount(shapeType);
+		}
+		InstanceData* instancePtr = static_cast<InstanceData*>(renderer->getMappedSSBOData(BATCH_INSTANCES, batchSize * sizeof(InstanceData)));
+		uint32_t* colorPtr = static_cast<uint32_t*>(renderer->getMappedSSBOData(BATCH_COLORS, batchSize * sizeof(uint32_t)));
+		DrawElementsIndirectCommand* commandPtr = static_cast<DrawElementsIndirectCommand*>(renderer->getMappedSSBOData(DRAW_COMMANDS, SHAPE_TYPE_COUNT * sizeof(DrawElementsIndirectCommand)));
+		uint32_t* visiblePtr = static_cast<uint32_t*>(renderer->getMappedSSBOData(VISIBLE_INSTANCES, batchSize * sizeof(uint32_t)));
+		cull.instanceCount = static_cast<uint32_t>(batchSize);
+		uint32_t firstInstance = 0;
+		for (int shapeType = T_CUBE; shapeType < SHAPE_TYPE_COUNT; ++shapeType) {
+			if (!gpuCulling) {
+				uint32_t visibleCount = shapeArray->getVisibleCount(shapeType);
+				shapeArray->uploadVisibleInstancesToPtr(shapeType, instancePtr + firstInstance);
+				shapeArray->uploadVisibleColorsToPtr(shapeType, colorPtr + firstInstance);
+				// the batch shader still reads every instance through VISIBLE_INSTANCES
+				for (uint32_t k = firstInstance; k < firstInstance + visibleCount; ++k) {
+					visiblePtr[k] = k;
+				}
+				commandPtr[shapeType] = renderer->getDrawCommand(shapeType, visibleCount, firstInstance);
+				firstInstance += visibleCount;
+				continue;
+			}
+			uint32_t typeSize = static_cast<uint32_t>(shapeArray->getShapeTypeArraySize(shapeType));
+			shapeArray->uploadInstancesToPtr(shapeType, instancePtr + firstInstance, alpha);
+			// TODO: only upload the new colours (super micro optimization since whole upload takes 0.000032ms)
+			shapeArray->uploadColorsToPtr(shapeType, BATCH_COLORS, colorPtr + firstInstance);
+			// skip the first cube and sphere, the enclosure and the hero are drawn separately
+			uint32_t skipped = (shapeType == T_CUBE || shapeType == T_SPHERE) && typeSize > 0 ? 1 : 0;
+			commandPtr[shapeType] = renderer->getDrawCommand(shapeType, 0, firstInstance + skipped);
+			cull.typeFirst[shapeType] = firstInstance + skipped;
+			cull.typeEnd[shapeType] = firstInstance + typeSize;
+			firstInstance += typeSize;
+		}
 #ifdef _DEBUG
 		bufferUpdateProfiler.end();
 #endif
 
-		// After upload draw all objects in batches per shape type
-		renderer->BindShader(BATCH_SHADER);
-#ifdef _DEBUG
-		cubeDrawProfiler.begin();
-#endif
-		renderer->BindShape(T_CUBE);
-		renderer->BindSSBO(0, CUBE_MATRICES);
-		renderer->BindSSBO(1, CUBE_COLORS);
-		renderer->renderBatch(T_CUBE, shapeArray->GetIndexPointerSize(T_CUBE), shapeArray->getShapeTypeArraySize(T_CUBE)-1, 1); // skip first cube as it's drawn separately
+		// Cull the batch instances against the frustum on the GPU, it writes the visible indices and instance counts
+		if (gpuCulling) {
 #ifdef _DEBUG
-		cubeDrawProfiler.end();
-		sphereDrawProfiler.begin();
+			cullProfiler.begin();
 #endif
-
-		renderer->BindShape(T_SPHERE);
-		renderer->BindSSBO(0, SPHERE_MATRICES);
-		renderer->BindSSBO(1, SPHERE_COLORS);
-		renderer->renderBatch(T_SPHERE, shapeArray->GetIndexPointerSize(T_SPHERE), shapeArray->getShapeTypeArraySize(T_SPHERE) - 1, 1); // skip first sphere as it's drawn separately
+			renderer->uploadUBOData(5, CULL_PARAMS, sizeof(cullParams), 0, &cull);
+			renderer->BindShader(CULL_SHADER);
+			renderer->BindSSBO(0, BATCH_INSTANCES);
+			renderer->BindSSBO(2, VISIBLE_INSTANCES);
+			renderer->BindSSBO(3, DRAW_COMMANDS);
+			renderer->dispatchCompute((cull.instanceCount + 63) / 64);
 #ifdef _DEBUG
-		sphereDrawProfiler.end();
-		cylinderDrawProfiler.begin();
+			cullProfiler.end();
 #endif
+		}
 
-		renderer->BindShape(T_CYLINDER);
-		renderer->BindSSBO(0, CYLINDER_MATRICES);
-		renderer->BindSSBO(1, CYLINDER_COLORS);
-		renderer->renderBatch(T_CYLINDER, shapeArray->GetIndexPointerSize(T_CYLINDER), shapeArray->getShapeTypeArraySize(T_CYLINDER), 0);
-
+		// After culling draw all visible objects in batches per shape type
+		renderer->uploadUBOData(4, VIEW_PROJECTION, sizeof(glm::mat4), 0, &viewProjection[0]);
+		renderer->BindShader(BATCH_SHADER);
 #ifdef _DEBUG
-		cylinderDrawProfiler.end();
-		ringDrawProfiler.begin();
+		batchDrawProfiler.begin();
 #endif
-		renderer->BindShape(T_RING);
-		renderer->BindSSBO(0, RING_MATRICES);
-		renderer->BindSSBO(1, RING_COLORS);
-		renderer->renderBatch(T_RING, shapeArray->GetIndexPointerSize(T_RING), shapeArray->getShapeTypeArraySize(T_RING), 0);
+		renderer->BindSSBO(0, BATCH_INSTANCES);
+		renderer->BindSSBO(1, BATCH_COLORS);
+		renderer->BindSSBO(2, VISIBLE_INSTANCES);
+		renderer->multiDrawIndirect(DRAW_COMMANDS, SHAPE_TYPE_COUNT);
 		renderer->unbindShader();
 #ifdef _DEBUG
-		ringDrawProfiler.end();
+		batchDrawProfiler.end();
 #endif
 		
 		// Cube drawing follows sphere without textures.
@@ -241,10 +309,8 @@ int ApplicationController::start() {
 #ifdef _DEBUG
 		if (++frameCount % 1000 == 0) {
 			bufferUpdateProfiler.printResult();
-			cubeDrawProfiler.printResult();
-			sphereDrawProfiler.printResult();
-			cylinderDrawProfiler.printResult();
-			ringDrawProfiler.printResult();
+			cullProfiler.printResult();
+			batchDrawProfiler.printResult();
 		}
 #endif
 		renderer->endFrame();
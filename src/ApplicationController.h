@@ -9,6 +9,9 @@
 #include <Windows.h>
 #endif
 
+#define PHYSICS_STEP (1.0f / 60.0f) // seconds simulated by one UpdatePhysics call
+#define MAX_PHYSICS_STEPS 4 // per rendered frame, the rest of a long frame is dropped
+
 class ApplicationController {
 private:
 	GLFWwindow* window;
@@ -16,8 +19,13 @@ private:
 	DynamicShapeArray* shapeArray;
 	InputController* inputController;
 	OpenGLRenderer* renderer; // TODO: change this to Renderer* when other renderers are implemented
+	float physicsStep;
+	uint32_t maxPhysicsSteps;
+	bool gpuCulling = true; // frustum culling in a compute pass, otherwise on the CPU before the upload
 public:
 	ApplicationController();
 	~ApplicationController();
+	void setPhysicsStep(float step, uint32_t maxStepsPerFrame);
+	void setGpuCulling(bool enabled);
 	int start();
 };
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+#include "Shape.h"
+#include "Transforms.h"
+#include <vector>
+#include <cstdint>
+
+// Structure-of-arrays storage for every body in the simulation, addressed by body index.
+// Hot data (center, speed, extent, type) lives in separate contiguous arrays so the integrate
+// and collision loops only stream the fields they touch. Scale, matrices and colors are cold:
+// they are only read by UpdateMatrices and the SSBO upload functions. prevX/Y/Z hold the centers
+// before the last physics step, so rendering can interpolate between the last two states.
+// Sleeping bodies (awake == 0) are neither integrated nor used to query the broadphase. They are
+// stopped while asleep and keep the speed they had in sleepVelX/Y/Z until they are woken.
+struct BodyStore {
+	// hot
+	std::vector<float> posX, posY, posZ;
+	std::vector<float> velX, velY, velZ;
+	std::vector<float> d;  // extent (diameter / edge length)
+	std::vector<float> d2; // secondary extent (ring tube radius)
+	std::vector<uint8_t> shapeType;
+	std::vector<uint8_t> awake;
+	std::vector<float> sleepTimer; // seconds spent below the sleep speed
+
+	// cold
+	std::vector<float> prevX, prevY, prevZ;
+	std::vector<float> sleepVelX, sleepVelY, sleepVelZ;
+	std::vector<glm::vec3> scale;
+	std::vector<uint32_t> packedScale; // scale as InstanceData stores it
+	std::vector<objMatrices> matrices;
+	std::vector<glm::vec4> colors;
+
+	inline uint32_t size() const { return static_cast<uint32_t>(posX.size()); }
+
+	void reserve(uint32_t count) {
+		posX.reserve(count); posY.reserve(count); posZ.reserve(count);
+		velX.reserve(count); velY.reserve(count); velZ.reserve(count);
+		d.reserve(count); d2.reserve(count);
+		shapeType.reserve(count);
+		awake.reserve(count);
+		sleepTimer.reserve(count);
+		prevX.reserve(count); prevY.reserve(count); prevZ.reserve(count);
+		sleepVelX.reserve(count); sleepVelY.reserve(count); sleepVelZ.reserve(count);
+		scale.reserve(count);
+		packedScale.reserve(count);
+		matrices.reserve(count);
+		colors.reserve(count);
+	}
+
+	// Reorders every array so that body k becomes the old body order[k]
+	void permute(const std::vector<uint32_t>& order) {
+		permuteArray(posX, order); permuteArray(posY, order); permuteArray(posZ, order);
+		permuteArray(velX, order); permuteArray(velY, order); permuteArray(velZ, order);
+		permuteArray(d, order); permuteArray(d2, order);
+		permuteArray(shapeType, order);
+		permuteArray(awake, order);
+		permuteArray(sleepTimer, order);
+		permuteArray(prevX, order); permuteArray(prevY, order); permuteArray(prevZ, order);
+		permuteArray(sleepVelX, order); permuteArray(sleepVelY, order); permuteArray(sleepVelZ, order);
+		permuteArray(scale, order);
+		permuteArray(packedScale, order);
+		permuteArray(matrices, order);
+		permuteArray(colors, order);
+	}
+
+	// Unpacks a factory-built Shape into the arrays and returns its body index
+	uint32_t push(const Shape& shape) {
+		uint32_t index = size();
+		posX.push_back(shape.center[0]);
+		posY.push_back(shape.center[1]);
+		posZ.push_back(shape.center[2]);
+		velX.push_back(shape.speed[0]);
+		velY.push_back(shape.speed[1]);
+		velZ.push_back(shape.speed[2]);
+		d.push_back(shape.d);
+		d2.push_back(shape.d2);
+		shapeType.push_back(static_cast<uint8_t>(shape.shapeType));
+		awake.push_back(1);
+		sleepTimer.push_back(0.f);
+		prevX.push_back(shape.center[0]);
+		prevY.push_back(shape.center[1]);
+		prevZ.push_back(shape.center[2]);
+		sleepVelX.push_back(0.f);
+		sleepVelY.push_back(0.f);
+		sleepVelZ.push_back(0.f);
+		scale.push_back(shape.scale);
+		packedScale.push_back(Transforms::PackScale(shape.scale));
+		matrices.push_back(shape.matrices);
+		colors.push_back(glm::vec4{ shape.color[0], shape.color[1], shape.color[2], shape.color[3] });
+		return index;
+	}
+
+private:
+	template<typename T>
+	static void permuteArray(std::vector<T>& values, const std::vector<uint32_t>& order) {
+		std::vector<T> permuted(values.size());
+		for (size_t k = 0; k < order.size(); ++k) {
+			permuted[k] = values[order[k]];
+		}
+		values.swap(permuted);
+	}
+};
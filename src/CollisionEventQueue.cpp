@@ -0,0 +1,49 @@
+#include "CollisionEventQueue.h"
+#include <bit>
+
+void CollisionEventQueue::setCapacity(uint32_t capacity) {
+	m_events.clear();
+	m_events.shrink_to_fit();
+	if (capacity > 0) {
+		m_events.resize(std::bit_ceil(capacity));
+	}
+	m_mask = m_events.empty() ? 0 : m_events.size() - 1;
+	m_head.store(0, std::memory_order_relaxed);
+	m_tail.store(0, std::memory_order_relaxed);
+	m_dropped.store(0, std::memory_order_relaxed);
+	m_droppedSteps.store(0, std::memory_order_relaxed);
+}
+
+uint32_t CollisionEventQueue::push(const CollisionEvent* events, uint32_t count) {
+	if (m_events.empty()) return 0;
+	const uint64_t head = m_head.load(std::memory_order_relaxed);
+	const uint64_t tail = m_tail.load(std::memory_order_acquire);
+	const uint64_t space = m_events.size() - (head - tail);
+	if (count > space) {
+		// a step is published whole or not at all
+		m_dropped.fetch_add(count, std::memory_order_relaxed);
+		m_droppedSteps.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	for (uint32_t k = 0; k < count; ++k) {
+		m_events[(head + k) & m_mask] = events[k];
+	}
+	// one release for the whole step, the consumer sees all of its events or none
+	m_head.store(head + count, std::memory_order_release);
+	return count;
+}
+
+uint32_t CollisionEventQueue::drain(std::vector<CollisionEvent>& out, uint32_t maxCount) {
+	if (m_events.empty()) return 0;
+	const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+	const uint64_t head = m_head.load(std::memory_order_acquire);
+	const uint64_t available = head - tail;
+	const uint32_t count = maxCount < available ? maxCount : static_cast<uint32_t>(available);
+	out.reserve(out.size() + count);
+	for (uint32_t k = 0; k < count; ++k) {
+		out.push_back(m_events[(tail + k) & m_mask]);
+	}
+	// the slots are free for the producer once the copies are done
+	m_tail.store(tail + count, std::memory_order_release);
+	return count;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// A resolved collision, written by the physics step before the response changes the speeds
+struct CollisionEvent {
+	uint32_t step;        // physics step the collision was resolved in
+	uint32_t bodyA;       // in the canonical pair order of the narrowphase
+	uint32_t bodyB;
+	uint8_t shapeTypeA;
+	uint8_t shapeTypeB;
+	uint8_t pairKind;     // NarrowPhase::PairKind
+	float point[3];       // on the line between the centers, where the extents of both bodies meet
+	float relativeSpeed;  // length of the speed difference, in the units of SetSpeed
+};
+
+/*
+Collision event queue
+- preallocated ring between the physics step (single producer) and one consumer, e.g. audio,
+  gameplay or telemetry, which may drain it from another thread. Neither side takes a lock.
+- the step publishes all of its events at once, so a consumer never sees half a step
+- a full ring never blocks the step: a step whose events don't all fit is dropped whole, and both
+  its events and the step are counted
+*/
+class CollisionEventQueue {
+public:
+	CollisionEventQueue() = default;
+	CollisionEventQueue(const CollisionEventQueue&) = delete;
+	CollisionEventQueue& operator=(const CollisionEventQueue&) = delete;
+
+	// Rounded up to a power of two, 0 disables the queue. Drops the queued events, so it must
+	// not be called while the producer or a consumer is using the queue.
+	void setCapacity(uint32_t capacity);
+	inline uint32_t getCapacity() const { return static_cast<uint32_t>(m_events.size()); }
+	inline bool enabled() const { return !m_events.empty(); }
+
+	// Producer: queues all of the events, or none of them when they don't fit, and returns how many
+	uint32_t push(const CollisionEvent* events, uint32_t count);
+
+	// Consumer: appends up to maxCount of the oldest events to out and returns how many
+	uint32_t drain(std::vector<CollisionEvent>& out, uint32_t maxCount = UINT32_MAX);
+
+	inline uint32_t getQueuedCount() const {
+		// tail first: the head read after it can only be further ahead, never behind
+		const uint64_t tail = m_tail.load(std::memory_order_acquire);
+		return static_cast<uint32_t>(m_head.load(std::memory_order_acquire) - tail);
+	}
+	inline uint64_t getDroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+	inline uint64_t getDroppedStepCount() const { return m_droppedSteps.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<CollisionEvent> m_events;
+	uint64_t m_mask = 0;
+	alignas(64) std::atomic<uint64_t> m_head{ 0 }; // next slot the producer writes
+	alignas(64) std::atomic<uint64_t> m_tail{ 0 }; // next slot the consumer reads
+	std::atomic<uint64_t> m_dropped{ 0 };
+	std::atomic<uint64_t> m_droppedSteps{ 0 };
+};
@@ -0,0 +1,283 @@
+#include "DynamicAABBTree.h"
+#include <algorithm>
+
+static inline AABB Combine(const AABB& a, const AABB& b) {
+	AABB result;
+	for (int axis = 0; axis < 3; ++axis) {
+		result.min[axis] = std::min(a.min[axis], b.min[axis]);
+		result.max[axis] = std::max(a.max[axis], b.max[axis]);
+	}
+	return result;
+}
+
+// Surface area heuristic, the constant factor doesn't matter
+static inline float Area(const AABB& box) {
+	float x = box.max[0] - box.min[0];
+	float y = box.max[1] - box.min[1];
+	float z = box.max[2] - box.min[2];
+	return x * y + y * z + z * x;
+}
+
+DynamicAABBTree::DynamicAABBTree(float fatMargin, float displacementMultiplier)
+	: m_fatMargin{ fatMargin }, m_displacementMultiplier{ displacementMultiplier } {
+}
+
+int32_t DynamicAABBTree::allocateNode() {
+	if (m_freeList == NULL_NODE) {
+		m_nodes.emplace_back();
+		return static_cast<int32_t>(m_nodes.size() - 1);
+	}
+	int32_t node = m_freeList;
+	m_freeList = m_nodes[node].parent;
+	m_nodes[node] = Node{};
+	return node;
+}
+
+void DynamicAABBTree::freeNode(int32_t node) {
+	m_nodes[node].parent = m_freeList;
+	m_nodes[node].height = -1;
+	m_freeList = node;
+}
+
+void DynamicAABBTree::clear() {
+	m_nodes.clear();
+	m_root = NULL_NODE;
+	m_freeList = NULL_NODE;
+	m_proxyCount = 0;
+}
+
+void DynamicAABBTree::fatten(AABB& box, float dx, float dy, float dz) const {
+	float displacement[3] = { dx * m_displacementMultiplier, dy * m_displacementMultiplier, dz * m_displacementMultiplier };
+	for (int axis = 0; axis < 3; ++axis) {
+		box.min[axis] -= m_fatMargin;
+		box.max[axis] += m_fatMargin;
+		// stretch in the direction of motion so moving proxies stay inside longer
+		if (displacement[axis] < 0.f) box.min[axis] += displacement[axis];
+		else box.max[axis] += displacement[axis];
+	}
+}
+
+int32_t DynamicAABBTree::createProxy(const AABB& box, uint32_t userData) {
+	int32_t proxy = allocateNode();
+	Node& node = m_nodes[proxy];
+	node.box = box;
+	fatten(node.box, 0.f, 0.f, 0.f);
+	node.userData = userData;
+	node.height = 0;
+	insertLeaf(proxy);
+	++m_proxyCount;
+	return proxy;
+}
+
+void DynamicAABBTree::destroyProxy(int32_t proxy) {
+	removeLeaf(proxy);
+	freeNode(proxy);
+	--m_proxyCount;
+}
+
+bool DynamicAABBTree::moveProxy(int32_t proxy, const AABB& box, float dx, float dy, float dz) {
+	if (m_nodes[proxy].box.contains(box)) {
+		return false;
+	}
+	removeLeaf(proxy);
+	m_nodes[proxy].box = box;
+	fatten(m_nodes[proxy].box, dx, dy, dz);
+	insertLeaf(proxy);
+	return true;
+}
+
+int32_t DynamicAABBTree::getHeight() const {
+	return m_root == NULL_NODE ? 0 : m_nodes[m_root].height;
+}
+
+void DynamicAABBTree::insertLeaf(int32_t leaf) {
+	if (m_root == NULL_NODE) {
+		m_root = leaf;
+		m_nodes[leaf].parent = NULL_NODE;
+		return;
+	}
+
+	// Find the best sibling by walking down the cheaper side
+	AABB leafBox = m_nodes[leaf].box;
+	int32_t index = m_root;
+	while (!m_nodes[index].isLeaf()) {
+		const Node& node = m_nodes[index];
+		int32_t child1 = node.child1;
+		int32_t child2 = node.child2;
+
+		float area = Area(node.box);
+		float combinedArea = Area(Combine(node.box, leafBox));
+
+		// cost of making a new parent for this node and the leaf
+		float cost = 2.f * combinedArea;
+		// minimum cost of pushing the leaf further down
+		float inheritanceCost = 2.f * (combinedArea - area);
+
+		float cost1 = Area(Combine(leafBox, m_nodes[child1].box)) + inheritanceCost;
+		if (!m_nodes[child1].isLeaf()) cost1 -= Area(m_nodes[child1].box);
+		float cost2 = Area(Combine(leafBox, m_nodes[child2].box)) + inheritanceCost;
+		if (!m_nodes[child2].isLeaf()) cost2 -= Area(m_nodes[child2].box);
+
+		if (cost < cost1 && cost < cost2) break;
+		index = cost1 < cost2 ? child1 : child2;
+	}
+	int32_t sibling = index;
+
+	// allocateNode can grow m_nodes, so no references are held across it
+	int32_t oldParent = m_nodes[sibling].parent;
+	int32_t newParent = allocateNode();
+	m_nodes[newParent].parent = oldParent;
+	m_nodes[newParent].box = Combine(leafBox, m_nodes[sibling].box);
+	m_nodes[newParent].height = m_nodes[sibling].height + 1;
+	m_nodes[newParent].child1 = sibling;
+	m_nodes[newParent].child2 = leaf;
+	m_nodes[sibling].parent = newParent;
+	m_nodes[leaf].parent = newParent;
+
+	if (oldParent != NULL_NODE) {
+		if (m_nodes[oldParent].child1 == sibling) m_nodes[oldParent].child1 = newParent;
+		else m_nodes[oldParent].child2 = newParent;
+	}
+	else {
+		m_root = newParent;
+	}
+
+	// Refit and rebalance the ancestors
+	index = m_nodes[leaf].parent;
+	while (index != NULL_NODE) {
+		index = balance(index);
+		Node& node = m_nodes[index];
+		node.height = 1 + std::max(m_nodes[node.child1].height, m_nodes[node.child2].height);
+		node.box = Combine(m_nodes[node.child1].box, m_nodes[node.child2].box);
+		index = node.parent;
+	}
+}
+
+void DynamicAABBTree::removeLeaf(int32_t leaf) {
+	if (leaf == m_root) {
+		m_root = NULL_NODE;
+		return;
+	}
+
+	int32_t parent = m_nodes[leaf].parent;
+	int32_t grandParent = m_nodes[parent].parent;
+	int32_t sibling = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+	if (grandParent == NULL_NODE) {
+		m_root = sibling;
+		m_nodes[sibling].parent = NULL_NODE;
+		freeNode(parent);
+		return;
+	}
+
+	// Replace the parent with the sibling and refit the ancestors
+	if (m_nodes[grandParent].child1 == parent) m_nodes[grandParent].child1 = sibling;
+	else m_nodes[grandParent].child2 = sibling;
+	m_nodes[sibling].parent = grandParent;
+	freeNode(parent);
+
+	int32_t index = grandParent;
+	while (index != NULL_NODE) {
+		index = balance(index);
+		Node& node = m_nodes[index];
+		node.height = 1 + std::max(m_nodes[node.child1].height, m_nodes[node.child2].height);
+		node.box = Combine(m_nodes[node.child1].box, m_nodes[node.child2].box);
+		index = node.parent;
+	}
+}
+
+// Rotates the taller child of iA up if the subtree is unbalanced. Returns the new subtree root.
+int32_t DynamicAABBTree::balance(int32_t iA) {
+	Node& A = m_nodes[iA];
+	if (A.isLeaf() || A.height < 2) {
+		return iA;
+	}
+
+	int32_t iB = A.child1;
+	int32_t iC = A.child2;
+	Node& B = m_nodes[iB];
+	Node& C = m_nodes[iC];
+	int32_t balanceFactor = C.height - B.height;
+
+	// Rotate C up
+	if (balanceFactor > 1) {
+		int32_t iF = C.child1;
+		int32_t iG = C.child2;
+		Node& F = m_nodes[iF];
+		Node& G = m_nodes[iG];
+
+		C.child1 = iA;
+		C.parent = A.parent;
+		A.parent = iC;
+
+		if (C.parent != NULL_NODE) {
+			if (m_nodes[C.parent].child1 == iA) m_nodes[C.parent].child1 = iC;
+			else m_nodes[C.parent].child2 = iC;
+		}
+		else {
+			m_root = iC;
+		}
+
+		if (F.height > G.height) {
+			C.child2 = iF;
+			A.child2 = iG;
+			G.parent = iA;
+			A.box = Combine(B.box, G.box);
+			C.box = Combine(A.box, F.box);
+			A.height = 1 + std::max(B.height, G.height);
+			C.height = 1 + std::max(A.height, F.height);
+		}
+		else {
+			C.child2 = iG;
+			A.child2 = iF;
+			F.parent = iA;
+			A.box = Combine(B.box, F.box);
+			C.box = Combine(A.box, G.box);
+			A.height = 1 + std::max(B.height, F.height);
+			C.height = 1 + std::max(A.height, G.height);
+		}
+		return iC;
+	}
+
+	// Rotate B up
+	if (balanceFactor < -1) {
+		int32_t iD = B.child1;
+		int32_t iE = B.child2;
+		Node& D = m_nodes[iD];
+		Node& E = m_nodes[iE];
+
+		B.child1 = iA;
+		B.parent = A.parent;
+		A.parent = iB;
+
+		if (B.parent != NULL_NODE) {
+			if (m_nodes[B.parent].child1 == iA) m_nodes[B.parent].child1 = iB;
+			else m_nodes[B.parent].child2 = iB;
+		}
+		else {
+			m_root = iB;
+		}
+
+		if (D.height > E.height) {
+			B.child2 = iD;
+			A.child1 = iE;
+			E.parent = iA;
+			A.box = Combine(C.box, E.box);
+			B.box = Combine(A.box, D.box);
+			A.height = 1 + std::max(C.height, E.height);
+			B.height = 1 + std::max(A.height, D.height);
+		}
+		else {
+			B.child2 = iE;
+			A.child1 = iD;
+			D.parent = iA;
+			A.box = Combine(C.box, D.box);
+			B.box = Combine(A.box, E.box);
+			A.height = 1 + std::max(C.height, D.height);
+			B.height = 1 + std::max(A.height, E.height);
+		}
+		return iB;
+	}
+
+	return iA;
+}
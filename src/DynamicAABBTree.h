@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+struct AABB {
+	float min[3];
+	float max[3];
+
+	inline bool overlaps(const AABB& other) const {
+		return !(max[0] < other.min[0] || other.max[0] < min[0] ||
+			max[1] < other.min[1] || other.max[1] < min[1] ||
+			max[2] < other.min[2] || other.max[2] < min[2]);
+	}
+	inline bool contains(const AABB& other) const {
+		return min[0] <= other.min[0] && min[1] <= other.min[1] && min[2] <= other.min[2] &&
+			other.max[0] <= max[0] && other.max[1] <= max[1] && other.max[2] <= max[2];
+	}
+};
+
+/*
+Dynamic AABB tree (bounding volume hierarchy)
+- every proxy is a leaf holding a fattened box, so small motions don't touch the tree at all
+- a proxy that leaves its fat box is removed and reinserted, and the ancestors are refitted
+  and rebalanced with tree rotations on the way up
+- a query visits O(log N) nodes for a box that overlaps few leaves
+*/
+class DynamicAABBTree {
+public:
+	static constexpr int32_t NULL_NODE = -1;
+
+	DynamicAABBTree(float fatMargin = 2.f, float displacementMultiplier = 2.f);
+
+	// Returns the proxy id, userData is handed back by queries
+	int32_t createProxy(const AABB& box, uint32_t userData);
+	void destroyProxy(int32_t proxy);
+	// Returns true if the proxy had to be reinserted. displacement is the expected motion for the next frame.
+	bool moveProxy(int32_t proxy, const AABB& box, float dx = 0.f, float dy = 0.f, float dz = 0.f);
+	void clear();
+
+	inline uint32_t getUserData(int32_t proxy) const { return m_nodes[proxy].userData; }
+	inline void setUserData(int32_t proxy, uint32_t userData) { m_nodes[proxy].userData = userData; }
+	inline const AABB& getFatAABB(int32_t proxy) const { return m_nodes[proxy].box; }
+	int32_t getHeight() const;
+	inline uint32_t getProxyCount() const { return m_proxyCount; }
+
+	// Calls callback(userData) for every proxy whose fat box overlaps box.
+	// Safe to call from several threads as long as nobody modifies the tree.
+	template<typename Callback>
+	void query(const AABB& box, Callback&& callback) const {
+		if (m_root == NULL_NODE) return;
+		// a depth first walk never holds more than height + 1 nodes
+		int32_t local[QUERY_STACK_SIZE];
+		std::vector<int32_t> spill;
+		int32_t* stack = local;
+		if (m_nodes[m_root].height + 1 > QUERY_STACK_SIZE) {
+			spill.resize(m_nodes[m_root].height + 1);
+			stack = spill.data();
+		}
+		int32_t top = 0;
+		stack[top++] = m_root;
+		while (top > 0) {
+			const Node& node = m_nodes[stack[--top]];
+			if (!node.box.overlaps(box)) continue;
+			if (node.isLeaf()) {
+				callback(node.userData);
+			}
+			else {
+				stack[top++] = node.child1;
+				stack[top++] = node.child2;
+			}
+		}
+	}
+
+private:
+	// the tree stays balanced, so its height only gets past this when it degenerates
+	static constexpr int32_t QUERY_STACK_SIZE = 256;
+
+	struct Node {
+		AABB box;
+		int32_t parent = NULL_NODE; // next free node while on the free list
+		int32_t child1 = NULL_NODE;
+		int32_t child2 = NULL_NODE;
+		int32_t height = -1; // leaf = 0, free node = -1
+		uint32_t userData = 0;
+
+		inline bool isLeaf() const { return child1 == NULL_NODE; }
+	};
+
+	std::vector<Node> m_nodes;
+	int32_t m_root = NULL_NODE;
+	int32_t m_freeList = NULL_NODE;
+	uint32_t m_proxyCount = 0;
+	float m_fatMargin;
+	float m_displacementMultiplier;
+
+	int32_t allocateNode();
+	void freeNode(int32_t node);
+	void insertLeaf(int32_t leaf);
+	void removeLeaf(int32_t leaf);
+	int32_t balance(int32_t index);
+	void fatten(AABB& box, float dx, float dy, float dz) const;
+};
@@ -1,10 +1,7 @@
 #include "DynamicShapeArray.h"
 #include <cmath>
-
-#ifdef _WIN32
-	#include <Windows.h>
-    #undef max
-#endif
+#include <algorithm>
+#include <bit>
 
 //Normals
 /*
@@ -26,17 +23,17 @@ bool firstSphere = true;
 bool soundsEnabled = false; // testing
 
 DynamicShapeArray::DynamicShapeArray() {
-	shapeFactory = new ShapeFactory();
+	shapeFactory = new ShapeFactory(&m_shapePool);
 	capacity = 10;
-	shapeArray.reserve(capacity);
-	m_nearbyCache.reserve(20);
+	bodies.reserve(capacity);
+	m_threadScratch.resize(m_threadPool.getThreadCount());
+	m_grid.setDenseBounds(m_worldBox.min[0], m_worldBox.min[1], m_worldBox.min[2], m_worldBox.max[0], m_worldBox.max[1], m_worldBox.max[2]);
+	m_cullGrid.setDenseBounds(m_worldBox.min[0], m_worldBox.min[1], m_worldBox.min[2], m_worldBox.max[0], m_worldBox.max[1], m_worldBox.max[2]);
 	size = 0;
 }
 
 DynamicShapeArray::~DynamicShapeArray() {
-	for (uint64_t i = 0; i < shapeArray.size(); ++i) {
-		delete shapeArray[i];
-	}
+	delete shapeFactory;
 }
 
 void DynamicShapeArray::CreateRandomShape() {
@@ -52,6 +49,7 @@ void DynamicShapeArray::CreateRandomShapes(int amount) {
 	maxSize = maxSize > 2 ? maxSize : 2;
 	maxSize = maxSize < 10 ? maxSize : 10;
 	float px = 0.f, py = 0.f, pz = 0.f;
+	bodies.reserve(size + perAxis * perAxis * perAxis);
 	for (int i = 0 ; i < perAxis; ++i) {
 		for (int j = 0; j < perAxis; ++j) {
 			for (int k = 0; k < perAxis; ++k) {
@@ -78,28 +76,60 @@ void DynamicShapeArray::InitFactoryPrototypes()
 }
 
 
-//Adds a shape to shapeArray
+//Unpacks a factory-built shape into the body store. The Shape itself is only a staging object,
+//its pool slot is reused by the next one.
 void DynamicShapeArray::AddShape(Shape *shape) {
-	shapeArray.push_back(shape);
-	shapeTypeArray.at(shape->shapeType).push_back(shapeArray.back()); // TODO: every time shapeArray resizes we lose the pointers.
+	uint32_t index = bodies.push(*shape);
+	shapeTypeArray.at(shape->shapeType).push_back(index);
+	m_shapePool.release(shape);
 	size++;
+	m_pairCache.setBodyCount(size);
+	if (index >= 2) {
+		m_awakeBodies.push_back(index);
+	}
 }
 
 
 void DynamicShapeArray::SetRandomColor(int index, float alpha_value) {
-	shapeFactory->SetRandomColor(*shapeArray[index], alpha_value);
+	shapeFactory->SetRandomColor(&bodies.colors[index][0], alpha_value);
 }
 
 void DynamicShapeArray::SetColor(int index, float r_value, float g_value, float b_value, float alpha_value) {
-	shapeFactory->SetColor(*shapeArray[index], r_value, g_value, b_value, alpha_value);
+	shapeFactory->SetColor(&bodies.colors[index][0], r_value, g_value, b_value, alpha_value);
 }
-void DynamicShapeArray::setRenderer(OpenGLRenderer* renderer) {
+void DynamicShapeArray::SetSpeed(int index, const glm::vec3& speed) {
+	// wake first, so the speed it restores is overwritten
+	if (index >= 2) {
+		WakeBody(index);
+		if (m_awakeDirty) RebuildAwakeList();
+	}
+	bodies.velX[index] = speed[0];
+	bodies.velY[index] = speed[1];
+	bodies.velZ[index] = speed[2];
+	m_pairCache.touchBody(index);
+}
+
+void DynamicShapeArray::SetSleepParameters(float speed, float time) {
+	m_sleepSpeed = speed;
+	m_sleepTime = time;
+	if (time > 0.f) return;
+	for (uint32_t i = 2; i < size; ++i) {
+		WakeBody(i);
+	}
+	if (m_awakeDirty) RebuildAwakeList();
+}
+
+void DynamicShapeArray::SetRandomSeed(uint32_t seed) {
+	shapeFactory->SetSeed(seed);
+}
+
+void DynamicShapeArray::setRenderer(Renderer* renderer) {
 	shapeFactory->setRenderer(renderer);
 }
 
 float* DynamicShapeArray::GetColor(uint32_t index) {
 	if (index < size) {
-		return shapeFactory->GetColor(*shapeArray[index]);
+		return &bodies.colors[index][0];
 	}
 	else return nullptr;
 }
@@ -113,54 +143,305 @@ float* DynamicShapeArray::GetNormals(int shapeType) {
 }
 
 void DynamicShapeArray::BindShape(int index) {
-	shapeFactory->BindShape(*shapeArray[index]);
+	shapeFactory->BindShape(bodies.shapeType[index]);
 }
 
 void DynamicShapeArray::UpdatePhysics(float deltaTime) {
+	++m_stepCount;
+	if (m_reorderInterval > 0 && ++m_framesSinceReorder >= m_reorderInterval) {
+		m_framesSinceReorder = 0;
+		ReorderBodies();
+	}
 	float speedFactor = speedUP * globalSpeed * deltaTime;
-	// Still i = 2 because first 2 shapes are immovable (cube and sphere)
-	for (uint32_t i = 2; i < size; ++i) {
-		Shape* shape = shapeArray[i];
-		shape->center[0] += shape->speed[0] * speedFactor;
-		shape->center[1] += shape->speed[1] * speedFactor;
-		shape->center[2] += shape->speed[2] * speedFactor;
+	m_speedFactor = speedFactor;
+	float* px = bodies.posX.data();
+	float* py = bodies.posY.data();
+	float* pz = bodies.posZ.data();
+	const float* vx = bodies.velX.data();
+	const float* vy = bodies.velY.data();
+	const float* vz = bodies.velZ.data();
+	std::copy(bodies.posX.begin(), bodies.posX.end(), bodies.prevX.begin());
+	std::copy(bodies.posY.begin(), bodies.posY.end(), bodies.prevY.begin());
+	std::copy(bodies.posZ.begin(), bodies.posZ.end(), bodies.prevZ.begin());
+	if (m_continuousCollision && SweepContinuous(speedFactor)) {
+		const float* toi = m_timeOfImpact.data();
+		for (uint32_t i : m_awakeBodies) {
+			px[i] += vx[i] * speedFactor * toi[i];
+			py[i] += vy[i] * speedFactor * toi[i];
+			pz[i] += vz[i] * speedFactor * toi[i];
+		}
+	}
+	else if (m_awakeBodies.size() + 2 == size) {
+		// Still i = 2 because first 2 shapes are immovable (cube and sphere)
+		for (uint32_t i = 2; i < size; ++i) {
+			px[i] += vx[i] * speedFactor;
+			py[i] += vy[i] * speedFactor;
+			pz[i] += vz[i] * speedFactor;
+		}
+	}
+	else {
+		for (uint32_t i : m_awakeBodies) {
+			px[i] += vx[i] * speedFactor;
+			py[i] += vy[i] * speedFactor;
+			pz[i] += vz[i] * speedFactor;
+		}
 	}
 	CheckAllCollisions();
+	UpdateSleep(deltaTime);
 }
 
-void DynamicShapeArray::UpdateMatrices(const glm::mat4& view, const glm::mat4& projection) {
-	// Still i = 2 because first 2 shapes are immovable (cube and sphere)
+void DynamicShapeArray::SetIncrementalGrid(bool enabled, float hysteresis) {
+	m_grid.setIncremental(enabled, hysteresis);
+	m_gridTracked = 0;
+}
+
+void DynamicShapeArray::SetCollisionEventCapacity(uint32_t capacity) {
+	m_collisionEvents.setCapacity(capacity);
+	m_stepEvents.clear();
+	m_carriedEvents = 0;
+}
+
+// Only moves the walls, the enclosure cube (body 0) keeps its mesh
+void DynamicShapeArray::SetWorldBox(const glm::vec3& min, const glm::vec3& max) {
+	for (int axis = 0; axis < 3; ++axis) {
+		m_worldBox.min[axis] = min[axis];
+		m_worldBox.max[axis] = max[axis];
+	}
+	m_grid.setDenseBounds(min.x, min.y, min.z, max.x, max.y, max.z);
+	m_cullGrid.setDenseBounds(min.x, min.y, min.z, max.x, max.y, max.z);
+	m_gridTracked = 0;
+}
+
+void DynamicShapeArray::SetReorderInterval(uint32_t frames) {
+	m_reorderInterval = frames;
+	m_framesSinceReorder = 0;
+}
+
+// Spreads the low 10 bits of v to every third bit
+static uint32_t ExpandBits(uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/*
+Morton order reordering
+- spawn order scatters neighboring bodies over memory, so the broadphase and narrowphase loops
+  keep missing the cache. Sorting the bodies by the Z-order code of their finest grid cell puts
+  bodies that are close in space close in memory.
+- bodies 0 and 1 (enclosure and hero sphere) keep their index
+- every per-body array and every structure that stores body indices is remapped, so the next
+  step carries on as if the bodies had been spawned in this order. Contacts are resolved in
+  body index order though, so the simulation takes a different (equally valid) path afterwards.
+*/
+void DynamicShapeArray::ReorderBodies() {
+	if (size <= 3) return;
+	const uint32_t movable = size - 2;
+	const float invCellSize = 1.f / m_grid.getCellSize(0);
+	m_reorderKeys.resize(movable);
+	m_threadPool.parallelFor(2, size, 4096, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t i = begin; i < end; ++i) {
+			// cells are counted from the world box corner, past 1023 on an axis they share their code
+			uint32_t cell[3];
+			float position[3] = { bodies.posX[i], bodies.posY[i], bodies.posZ[i] };
+			for (int axis = 0; axis < 3; ++axis) {
+				float c = (position[axis] - m_worldBox.min[axis]) * invCellSize;
+				cell[axis] = c > 0.f ? (c < 1023.f ? (uint32_t)c : 1023u) : 0u;
+			}
+			uint32_t code = ExpandBits(cell[0]) | (ExpandBits(cell[1]) << 1) | (ExpandBits(cell[2]) << 2);
+			m_reorderKeys[i - 2] = (uint64_t)code << 32 | i;
+		}
+	});
+	m_radixSorter.sort(m_threadPool, m_reorderKeys, 32, 30);
+
+	m_reorderOrder.resize(size);
+	m_reorderOrder[0] = 0;
+	m_reorderOrder[1] = 1;
+	bool unchanged = true;
+	for (uint32_t k = 0; k < movable; ++k) {
+		m_reorderOrder[k + 2] = (uint32_t)m_reorderKeys[k];
+		unchanged = unchanged && m_reorderOrder[k + 2] == k + 2;
+	}
+	if (unchanged) return;
+	m_reorderNewIndex.resize(size);
+	for (uint32_t k = 0; k < size; ++k) {
+		m_reorderNewIndex[m_reorderOrder[k]] = k;
+	}
+
+	bodies.permute(m_reorderOrder);
+	for (std::vector<uint32_t>& indices : shapeTypeArray) {
+		indices.clear();
+	}
+	for (uint32_t i = 0; i < size; ++i) {
+		shapeTypeArray[bodies.shapeType[i]].push_back(i);
+	}
+
+	m_gridTracked = 0;
+	m_fellAsleep.clear();
+	m_pairCache.remap(m_reorderNewIndex);
+	for (CollisionEvent& event : m_stepEvents) {
+		event.bodyA = m_reorderNewIndex[event.bodyA];
+		event.bodyB = m_reorderNewIndex[event.bodyB];
+	}
+	m_SweepAndPrune.remap(m_reorderNewIndex);
+	m_sweptSAP.remap(m_reorderNewIndex);
+	if (!m_treeProxies.empty()) {
+		std::vector<int32_t> proxies(m_treeProxies.size(), DynamicAABBTree::NULL_NODE);
+		for (uint32_t i = 0; i < (uint32_t)m_treeProxies.size(); ++i) {
+			int32_t proxy = m_treeProxies[i];
+			proxies[m_reorderNewIndex[i]] = proxy;
+			if (proxy != DynamicAABBTree::NULL_NODE) {
+				m_AABBTree.setUserData(proxy, m_reorderNewIndex[i]);
+			}
+		}
+		m_treeProxies.swap(proxies);
+	}
+	RebuildAwakeList();
+}
+
+void DynamicShapeArray::UpdateMatrices(const glm::mat4& view, const glm::mat4& projection, float alpha) {
+	if (size < 2) return;
 	glm::mat4 viewProj = projection * view;
-	for (uint32_t i = 1; i < size; ++i) {
-		Shape* shape = shapeArray[i];
-		glm::mat4 model{ 1.f };
+	// New approach, translate using center instead of speed to avoid speedups
+	// The hero sphere is moved by input every rendered frame, so it is drawn where it is
+	Transforms::BodyTransforms transforms{
+		{ bodies.posX.data(), bodies.posY.data(), bodies.posZ.data() },
+		{ nullptr, nullptr, nullptr },
+		bodies.scale.data(), bodies.matrices.data() };
+	Transforms::UpdateMatrices(viewProj, transforms, 1, 2, 1.f);
+
+	// Still i = 2 because first 2 shapes are immovable (cube and sphere)
+	transforms.prev[0] = bodies.prevX.data();
+	transforms.prev[1] = bodies.prevY.data();
+	transforms.prev[2] = bodies.prevZ.data();
+	m_threadPool.parallelFor(2, size, 4096, [&](uint32_t begin, uint32_t end, uint32_t) {
+		Transforms::UpdateMatrices(viewProj, transforms, begin, end, alpha);
+	});
+}
+
+void DynamicShapeArray::UpdateHeroMatrices(const glm::mat4& view, const glm::mat4& projection) {
+	if (size < 2) return;
+	const Transforms::BodyTransforms transforms{
+		{ bodies.posX.data(), bodies.posY.data(), bodies.posZ.data() },
+		{ nullptr, nullptr, nullptr },
+		bodies.scale.data(), bodies.matrices.data() };
+	Transforms::UpdateMatrices(projection * view, transforms, 1, 2, 1.f);
+}
+
+// 16 bytes per body instead of the 176 of objMatrices, the batch shader builds the matrices
+void DynamicShapeArray::uploadInstancesToPtr(int shapeType, void* ptr, float alpha) {
+	InstanceData* instances = static_cast<InstanceData*>(ptr);
+	const std::vector<uint32_t>& indices = shapeTypeArray[shapeType];
+	m_threadPool.parallelFor(0, (uint32_t)indices.size(), 8192, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t k = begin; k < end; ++k) {
+			const uint32_t i = indices[k];
+			InstanceData& instance = instances[k];
+			instance.center[0] = bodies.posX[i];
+			instance.center[1] = bodies.posY[i];
+			instance.center[2] = bodies.posZ[i];
+			// the enclosure and the hero sphere are drawn where they are, like in UpdateMatrices
+			if (i > 1) {
+				instance.center[0] = bodies.prevX[i] + (instance.center[0] - bodies.prevX[i]) * alpha;
+				instance.center[1] = bodies.prevY[i] + (instance.center[1] - bodies.prevY[i]) * alpha;
+				instance.center[2] = bodies.prevZ[i] + (instance.center[2] - bodies.prevZ[i]) * alpha;
+			}
+			instance.scale = bodies.packedScale[i];
+		}
+	});
+}
+
+/*
+CPU culling
+- the movable bodies go into a dense grid by their blended center, then every occupied cell's box,
+  grown by the largest bounding radius, is tested against the frustum first. Cells outside are
+  dropped whole, cells inside are kept whole, and only the bodies of cells crossing a plane are
+  tested one by one.
+- the kept bodies are listed per shape type, so the uploads and the draws only cover those
+*/
+void DynamicShapeArray::CullBodies(const glm::vec4 planes[6], const float typeRadius[SHAPE_TYPE_COUNT], float alpha) {
+	for (std::vector<uint32_t>& visible : m_visibleBodies) {
+		visible.clear();
+	}
+	if (size <= 2) return;
+	m_cullSpheres.resize(size);
+	m_cullGrid.clear();
+	float maxRadius = 0.f;
+	// first 2 shapes are drawn separately (cube and sphere)
+	for (uint32_t i = 2; i < size; ++i) {
+		glm::vec4& sphere = m_cullSpheres[i];
+		sphere.x = bodies.prevX[i] + (bodies.posX[i] - bodies.prevX[i]) * alpha;
+		sphere.y = bodies.prevY[i] + (bodies.posY[i] - bodies.prevY[i]) * alpha;
+		sphere.z = bodies.prevZ[i] + (bodies.posZ[i] - bodies.prevZ[i]) * alpha;
+		const glm::vec3& scale = bodies.scale[i];
+		sphere.w = typeRadius[bodies.shapeType[i]] * std::max(std::max(scale.x, scale.y), scale.z);
+		maxRadius = std::max(maxRadius, sphere.w);
+		m_cullGrid.insert(i, sphere.x, sphere.y, sphere.z);
+	}
+	m_cullGrid.build();
+
+	const uint32_t cellCount = m_cullGrid.getCellCount();
+	for (uint32_t cell = 0; cell < cellCount; ++cell) {
+		uint32_t count;
+		const uint32_t* objects = m_cullGrid.getCellObjects(cell, count);
+		if (count == 0) continue;
+		float min[3], max[3];
+		m_cullGrid.getCellBounds(cell, min, max);
+		for (int axis = 0; axis < 3; ++axis) {
+			min[axis] -= maxRadius;
+			max[axis] += maxRadius;
+		}
+		const Transforms::FrustumTest test = Transforms::TestBox(planes, min, max);
+		if (test == Transforms::FRUSTUM_OUTSIDE) continue;
+		for (uint32_t k = 0; k < count; ++k) {
+			const uint32_t i = objects[k];
+			const glm::vec4& sphere = m_cullSpheres[i];
+			const float center[3] = { sphere.x, sphere.y, sphere.z };
+			if (test == Transforms::FRUSTUM_INSIDE || Transforms::SphereInFrustum(planes, center, sphere.w)) {
+				m_visibleBodies[bodies.shapeType[i]].push_back(i);
+			}
+		}
+	}
+}
 
-		// New approach, translate using center instead of speed to avoid speedups
-		model = glm::translate(glm::mat4{ 1.f }, glm::vec3(shape->center[0], shape->center[1], shape->center[2]));
-		model = glm::scale(model, shape->scale);
-		shape->matrices.model = model;
-		shape->matrices.normalModel = glm::mat3x4{ glm::transpose(glm::inverse(shape->matrices.model)) };
-		shape->matrices.mvp = viewProj * shape->matrices.model;
+void DynamicShapeArray::uploadVisibleInstancesToPtr(int shapeType, void* ptr) {
+	InstanceData* instances = static_cast<InstanceData*>(ptr);
+	const std::vector<uint32_t>& indices = m_visibleBodies[shapeType];
+	m_threadPool.parallelFor(0, (uint32_t)indices.size(), 8192, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t k = begin; k < end; ++k) {
+			const uint32_t i = indices[k];
+			InstanceData& instance = instances[k];
+			// blended by CullBodies already
+			instance.center[0] = m_cullSpheres[i].x;
+			instance.center[1] = m_cullSpheres[i].y;
+			instance.center[2] = m_cullSpheres[i].z;
+			instance.scale = bodies.packedScale[i];
+		}
+	});
+}
+
+void DynamicShapeArray::uploadVisibleColorsToPtr(int shapeType, void* ptr) {
+	uint32_t* colorsPtr = static_cast<uint32_t*>(ptr);
+	const std::vector<uint32_t>& indices = m_visibleBodies[shapeType];
+	for (uint64_t i = 0; i < indices.size(); ++i) {
+		colorsPtr[i] = Transforms::PackColor(bodies.colors[indices[i]]);
 	}
 }
 
 void DynamicShapeArray::uploadMatricesToPtr(int shapeType, uint16_t type, void* ptr) {
 	objMatrices* matricesPtr = static_cast<objMatrices*>(ptr);
-	for (uint64_t i = 0; i < shapeTypeArray[shapeType].size(); ++i) {
-		Shape* shape = shapeTypeArray[shapeType][i];
-		matricesPtr[i].mvp = shape->matrices.mvp;
-		matricesPtr[i].model = shape->matrices.model;
-		matricesPtr[i].normalModel = shape->matrices.normalModel;
+	const std::vector<uint32_t>& indices = shapeTypeArray[shapeType];
+	for (uint64_t i = 0; i < indices.size(); ++i) {
+		matricesPtr[i] = bodies.matrices[indices[i]];
 	}
 }
 void DynamicShapeArray::uploadColorsToPtr(int shapeType, uint16_t type, void* ptr) {
-	float* colorsPtr = static_cast<float*>(ptr);
-	for (uint64_t i = 0; i < shapeTypeArray[shapeType].size(); ++i) {
-		Shape* shape = shapeTypeArray[shapeType][i];
-		colorsPtr[i * 4 + 0] = shape->color[0];
-		colorsPtr[i * 4 + 1] = shape->color[1];
-		colorsPtr[i * 4 + 2] = shape->color[2];
-		colorsPtr[i * 4 + 3] = shape->color[3];
+	uint32_t* colorsPtr = static_cast<uint32_t*>(ptr);
+	const std::vector<uint32_t>& indices = shapeTypeArray[shapeType];
+	for (uint64_t i = 0; i < indices.size(); ++i) {
+		colorsPtr[i] = Transforms::PackColor(bodies.colors[indices[i]]);
 	}
 }
 
@@ -171,21 +452,23 @@ void DynamicShapeArray::uploadColorsToPtr(int shapeType, uint16_t type, void* pt
 
 void DynamicShapeArray::MoveSphere(int index, glm::vec3 speed)
 {
-	Shape& shape = *shapeArray[index];
-	float next_center[3] = { shape.center[0] + sphereSpeed * speed[0],
-	shape.center[1] + sphereSpeed * speed[1],
-	shape.center[2] + sphereSpeed * speed[2]};
+	float next_center[3] = { bodies.posX[index] + sphereSpeed * speed[0],
+	bodies.posY[index] + sphereSpeed * speed[1],
+	bodies.posZ[index] + sphereSpeed * speed[2]};
 
-	float upper_limit = 100.0f - shape.d / 2;
-	float lower_limit = 0 + shape.d / 2;
+	float half = bodies.d[index] / 2;
 	for (uint32_t i = 2; i < size; ++i) {
-		CheckCollisionPair(i, index); // Check for sphere
+		CheckCollisionPair(i, index, m_stepEvents); // Check for sphere
 	}
-	if (next_center[0] > upper_limit || next_center[1] > upper_limit || next_center[2] > upper_limit || next_center[0] < lower_limit || next_center[1] < lower_limit || next_center[2] < lower_limit)
-		return;
-	shape.center[0] = next_center[0];
-	shape.center[1] = next_center[1];
-	shape.center[2] = next_center[2];
+	// published with the next step, so a step never reaches the queue in two parts
+	m_carriedEvents = static_cast<uint32_t>(m_stepEvents.size());
+	for (int axis = 0; axis < 3; ++axis) {
+		if (next_center[axis] > m_worldBox.max[axis] - half || next_center[axis] < m_worldBox.min[axis] + half)
+			return;
+	}
+	bodies.posX[index] = next_center[0];
+	bodies.posY[index] = next_center[1];
+	bodies.posZ[index] = next_center[2];
 }
 
 /*
@@ -204,234 +487,645 @@ void DynamicShapeArray::SpeedUP(bool up) {
 	
 }
 
+void DynamicShapeArray::SetSpeedUP(int value) {
+	speedUP = std::clamp(value, 0, MAX_SPEEDUP);
+}
+
+void DynamicShapeArray::SetContinuousCollision(bool enabled) {
+	m_continuousCollision = enabled;
+}
+
+void DynamicShapeArray::ToggleContinuousCollision() {
+	m_continuousCollision = !m_continuousCollision;
+	std::cout << "Continuous collision: " << (m_continuousCollision ? "on" : "off") << std::endl;
+}
+
+void DynamicShapeArray::SetBroadphase(BroadphaseType type) {
+	m_broadphase = type;
+}
+
+void DynamicShapeArray::CycleBroadphase() {
+	m_broadphase = static_cast<BroadphaseType>((m_broadphase + 1) % BROADPHASE_COUNT);
+	const char* names[BROADPHASE_COUNT] = { "grid", "sweep and prune", "AABB tree" };
+	std::cout << "Broadphase: " << names[m_broadphase] << std::endl;
+}
+
+void DynamicShapeArray::SetThreadCount(uint32_t threadCount) {
+	m_threadPool.resize(threadCount);
+	m_threadScratch.resize(m_threadPool.getThreadCount());
+}
+
+/*
+Collision pipeline
+- broadphase and narrowphase run on the thread pool and only read body state. Every thread
+  collects its hits into its own contact list.
+- contacts are then merged, sorted by body pair and resolved on the calling thread, so the
+  result is bit-identical for any thread count.
+- the enclosure walls are an analytic stage over the awake bodies (see ResolveWalls), the hero
+  sphere test only writes the speed of the body it is run for, so both run in parallel directly.
+- only awake bodies query the broadphase. Sleeping ones stay in it so awake bodies still find
+  them, and are woken once an awake body's predicted box overlaps theirs.
+*/
 void DynamicShapeArray::CheckAllCollisions() {
-	m_SpatialGrid.clear();
-	std::vector<int> largeObjects; // Special case for large objects that span multiple cells
+	for (ThreadScratch& scratch : m_threadScratch) {
+		scratch.contacts.clear();
+		scratch.pendingPairs.clear();
+		scratch.wake.clear();
+		scratch.events.clear();
+	}
+	m_pairCache.beginFrame(m_speedFactor);
 
-	// skip immovable objects 0, 1
-	for (uint32_t i = 2; i < size; ++i) { 
-		Shape* shape = shapeArray[i];
+	if (m_broadphase == BROADPHASE_SAP) {
+		FindSweepAndPruneContacts();
+	}
+	else if (m_broadphase == BROADPHASE_TREE) {
+		FindTreeContacts();
+	}
+	else {
+		FindGridContacts();
+	}
+	if (m_broadphase != BROADPHASE_GRID) {
+		m_gridTracked = 0; // bodies move without the grid following them
+	}
+	m_fellAsleep.clear();
+	for (const ThreadScratch& scratch : m_threadScratch) {
+		m_pairCache.insert(scratch.pendingPairs);
+	}
+	m_pairCache.endFrame(bodies.awake.data());
 
-		if (shape->d > 30.f) {
-			largeObjects.push_back(i);
-		} else {
-			// Next positions
-			float px = shape->center[0] + shape->speed[0];
-			float py = shape->center[1] + shape->speed[1];
-			float pz = shape->center[2] + shape->speed[2];
-			m_SpatialGrid.insert(i, px, py, pz);
+	for (const ThreadScratch& scratch : m_threadScratch) {
+		for (uint32_t index : scratch.wake) {
+			WakeBody(index);
 		}
 	}
+	if (m_awakeDirty) RebuildAwakeList();
+	ResolveContacts();
+	ResolveWalls();
+	PublishCollisionEvents();
+}
 
-	for (uint32_t i = 2; i < size; ++i) {
-		if (shapeArray[i]->d > 30.f) continue;
-		Shape* shape = shapeArray[i];
-		float px = shape->center[0] + shape->speed[0];
-		float py = shape->center[1] + shape->speed[1];
-		float pz = shape->center[2] + shape->speed[2];
-		m_nearbyCache.clear();	
-		m_SpatialGrid.queryNeighbors(px, py, pz, m_nearbyCache);
+/*
+Enclosure walls
+- instead of running every awake body through the pair narrowphase against body 0, the six
+  planes of the world box are tested per axis in one streaming SIMD pass: a body whose predicted
+  position reaches past a wall while moving towards it has that speed component flipped, and
+  its position is clamped to the inside of the box
+- with every body awake the pass runs over the body arrays directly, otherwise over the awake list
+- the hero sphere pair follows for the same bodies, on the speeds the walls left
+*/
+void DynamicShapeArray::ResolveWalls() {
+	const uint32_t awakeCount = (uint32_t)m_awakeBodies.size();
+	const bool allAwake = awakeCount + 2 == size;
+	m_wallHits.resize(awakeCount);
+	const NarrowPhase::BodyState state{
+		{ bodies.posX.data(), bodies.posY.data(), bodies.posZ.data() },
+		{ bodies.velX.data(), bodies.velY.data(), bodies.velZ.data() },
+		bodies.d.data() };
+	m_threadPool.parallelFor(0, awakeCount, 1024, [&](uint32_t begin, uint32_t end, uint32_t thread) {
+		if (allAwake) {
+			NarrowPhase::ResolveWalls(m_worldBox, state, begin + 2, end + 2, m_wallHits.data() + begin);
+		}
+		else {
+			NarrowPhase::ResolveWalls(m_worldBox, state, m_awakeBodies.data() + begin, end - begin, m_wallHits.data() + begin);
+		}
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = m_awakeBodies[k];
+			if (m_wallHits[k]) m_pairCache.touchBody(i);
+			CheckCollisionPair(i, 1, m_threadScratch[thread].events); // Check for sphere
+		}
+	});
+}
 
-		for (uint32_t j : m_nearbyCache) {
-			if (j <= i) continue; // avoid double checks
-			CheckCollisionPair(i, j);
+/*
+Grid update
+- rebuild mode inserts every movable body at its predicted position each step
+- incremental mode keeps the grid between steps. New bodies are inserted, and only bodies whose
+  predicted position moved more than the hysteresis margin out of their cell are moved, so the
+  cost follows the awake bodies instead of all of them. Sleeping bodies don't move, except
+  for the step in which they are stopped.
+*/
+void DynamicShapeArray::UpdateGrid() {
+	if (m_gridLevel.size() < size) {
+		m_gridLevel.resize(size, 0);
+	}
+	const float* posX = bodies.posX.data();
+	const float* posY = bodies.posY.data();
+	const float* posZ = bodies.posZ.data();
+	const float* velX = bodies.velX.data();
+	const float* velY = bodies.velY.data();
+	const float* velZ = bodies.velZ.data();
+	const float* extent = bodies.d.data();
+
+	if (!m_grid.isIncremental()) {
+		m_grid.clear();
+		// skip immovable objects 0, 1
+		for (uint32_t i = 2; i < size; ++i) {
+			// Next positions
+			m_gridLevel[i] = (uint8_t)m_grid.insert(i, posX[i] + velX[i], posY[i] + velY[i], posZ[i] + velZ[i], extent[i]);
 		}
+		m_grid.build();
+		return;
 	}
 
-	// We don't have large movable objects yet
-	for (int largeIdx : largeObjects) {
-		for (uint32_t i = 2; i < size; ++i) {
-			if (i == largeIdx) continue;
-			CheckCollisionPair(largeIdx, i);
+	if (m_gridTracked == 0) {
+		m_grid.clear();
+		m_gridTracked = 2;
+	}
+	for (uint32_t i : m_fellAsleep) {
+		if (i < m_gridTracked && m_grid.needsMove(i, m_gridLevel[i], posX[i], posY[i], posZ[i], extent[i])) {
+			m_grid.move(i, m_gridLevel[i], posX[i], posY[i], posZ[i]);
+		}
+	}
+	for (uint32_t i = m_gridTracked; i < size; ++i) {
+		m_gridLevel[i] = (uint8_t)m_grid.insert(i, posX[i] + velX[i], posY[i] + velY[i], posZ[i] + velZ[i], extent[i]);
+	}
+	m_gridTracked = size;
+
+	// finding the movers only reads, moving them relinks cells and runs in body order
+	const uint8_t* gridLevel = m_gridLevel.data();
+	m_gridMoves.resize(m_awakeBodies.size());
+	m_threadPool.parallelFor(0, (uint32_t)m_awakeBodies.size(), 4096, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = m_awakeBodies[k];
+			m_gridMoves[k] = m_grid.needsMove(i, gridLevel[i], posX[i] + velX[i], posY[i] + velY[i], posZ[i] + velZ[i], extent[i]);
 		}
+	});
+	for (uint32_t k = 0; k < (uint32_t)m_awakeBodies.size(); ++k) {
+		if (!m_gridMoves[k]) continue;
+		uint32_t i = m_awakeBodies[k];
+		m_grid.move(i, gridLevel[i], posX[i] + velX[i], posY[i] + velY[i], posZ[i] + velZ[i]);
 	}
+}
 
-	for (uint32_t i = 2; i < size; ++i) {
-		CheckCollisionPair(i, 0); // Check for cube
-		CheckCollisionPair(i, 1); // Check for sphere
-	}
-
-}
-
-void DynamicShapeArray::CheckCollisionPair(int i, int j) {
-	bool hasCollision{ false };
-	//bool hasCollision; This is here to debug when all if statements are passed since VS breaks when an uninitialized bool is used
-
-	Shape* shapeI = shapeArray[i];
-	Shape* shapeJ = shapeArray[j];
-	float iPos[] = { shapeI->center[0] + shapeI->speed[0],
-		shapeI->center[1] + shapeI->speed[1],
-		shapeI->center[2] + shapeI->speed[2] };
-	float jPos[] = { shapeJ->center[0] + shapeJ->speed[0],
-		shapeJ->center[1] + shapeJ->speed[1],
-		shapeJ->center[2] + shapeJ->speed[2] };
-
-	float* pos = iPos , * pos1 = jPos;
-	int shapeIType, shapeJType, s;
-	float dsqr, dx, dy, dz, size0 = shapeI->d, size02 = shapeI->d2, size1 = shapeJ->d, size1div2, size0div2, size10, size10div2, size1p0div2;
-
-	s = i;
-	shapeIType = shapeI->shapeType;
-	shapeJType = shapeJ->shapeType;
-
-	// Swap shapes to canonical ordering:
-	// - Ring always goes to I
-	// - Sphere always goes to I unless paired with Ring
-	// - Cylinder goes to I only if paired with Cube
-	if ( ( (shapeJType == T_RING || shapeJType == T_SPHERE) && (shapeIType != T_RING) ) || 
-		(shapeIType == T_CUBE && shapeJType == T_CYLINDER) ) {
-		std::swap(size0, size1);
-		size02 = shapeJ->d2;
-		std::swap(shapeIType, shapeJType);
-		std::swap(i, j);
-
-		std::swap(pos1, pos);
-	}
-
-	size1div2 = size1 * .5f;
-	size0div2 = size0 * .5f;
-	size1p0div2 = size1div2 + size0div2;
-	size10 = size1 - size0;
-	size10 = size10 < 0 ? -size10 : size10;
-	size10div2 = size10 * .5f;
-
-	// AABB early test 
-	if (pos[0] + size0div2 < pos1[0] - size1div2 || pos1[0] + size1div2 < pos[0] - size0div2) return;
-	if (pos[1] + size0div2 < pos1[1] - size1div2 || pos1[1] + size1div2 < pos[1] - size0div2) return;
-	if (pos[2] + size0div2 < pos1[2] - size1div2 || pos1[2] + size1div2 < pos[2] - size0div2) return;
-	
-//	dx = abs(pos[0] - pos1[0]);
-//	dy = abs(pos[1] - pos1[1]);
-//	dz = abs(pos[2] - pos1[2]);
-	// This unintelligible code is faster than std::abs, still left it here for readability
-	dx = pos[0] - pos1[0];
-	dx = dx < 0 ? -dx : dx;
-	dy = pos[1] - pos1[1];
-	dy = dy < 0 ? -dy : dy;
-	dz = pos[2] - pos1[2];
-	dz = dz < 0 ? -dz : dz;
-	if (shapeIType == T_SPHERE) {
-		if (shapeJType == T_SPHERE) {
-			dsqr = dx * dx + dy * dy + dz * dz;
-			hasCollision = (dsqr <= (size1p0div2 * size1p0div2)) && (dsqr >= size1 * size1 / 4.f);
-		}
-		else if (shapeJType == T_CUBE) {
-
-			if (dx >= (size1p0div2)) { hasCollision = false; }
-			else if (dy >= (size1p0div2)) { hasCollision = false; }
-			else if (dz >= (size1p0div2)) { hasCollision = false; }
-			//be completely in
-			else if ((dx < size10div2) && (dy < size10div2) && (dz < size10div2)) { hasCollision = false; }
-
-			else if (dx < (size1div2)) { hasCollision = true; }
-			else if (dy < (size1div2)) { hasCollision = true; }
-			else if (dz < (size1div2)) { hasCollision = true; }
-			else {
-				float cornerDistance_sq = ((dx - size1div2) * (dx - size1div2)) +
-					((dy - size1div2) * (dy - size1div2)) +
-					((dz - size1div2) * (dz - size1div2));
-				hasCollision = (cornerDistance_sq < (size0div2 * size0div2));
-			}
+/*
+Grid broadphase
+- every movable body goes into the grid level whose cells are at least as large as the body, so
+  a pair is always in neighboring cells of the finer body's level or a coarser one
+- awake bodies query their own level and every coarser one. Pairs on one level are kept once
+  (by the lower index when both are awake), pairs across levels by the finer body only.
+- a sleeping body doesn't query its own level, but an awake body on a coarser level never looks
+  at finer ones, so sleepers below the coarsest awake level look upward for awake bodies.
+*/
+void DynamicShapeArray::FindGridContacts() {
+	UpdateGrid();
+
+	const float* posX = bodies.posX.data();
+	const float* posY = bodies.posY.data();
+	const float* posZ = bodies.posZ.data();
+	const float* velX = bodies.velX.data();
+	const float* velY = bodies.velY.data();
+	const float* velZ = bodies.velZ.data();
+	const uint8_t* awake = bodies.awake.data();
+	const uint8_t* gridLevel = m_gridLevel.data();
+
+	uint32_t topAwakeLevel = 0;
+	for (uint32_t i : m_awakeBodies) {
+		if (gridLevel[i] > topAwakeLevel) topAwakeLevel = gridLevel[i];
+	}
 
+	m_threadPool.parallelFor(0, (uint32_t)m_awakeBodies.size(), 256, [&](uint32_t begin, uint32_t end, uint32_t thread) {
+		ThreadScratch& scratch = m_threadScratch[thread];
+		uint32_t sameLevelCount;
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = m_awakeBodies[k];
+			float px = posX[i] + velX[i];
+			float py = posY[i] + velY[i];
+			float pz = posZ[i] + velZ[i];
+			m_grid.query(px, py, pz, gridLevel[i], scratch.nearby, sameLevelCount);
+
+			for (uint32_t n = 0; n < (uint32_t)scratch.nearby.size(); ++n) {
+				uint32_t j = scratch.nearby[n];
+				if (n < sameLevelCount) {
+					if (j <= i && awake[j]) continue; // avoid double checks, sleeping bodies don't query
+				}
+				else if (!PredictedBoxesOverlap(i, j)) continue; // coarse cells are loose around small bodies
+				AddCandidate(i, j, scratch);
+			}
+		}
+		FlushCandidates(scratch);
+	});
+
+	if (m_awakeBodies.size() + 2 == size) return;
+	m_threadPool.parallelFor(2, size, 1024, [&](uint32_t begin, uint32_t end, uint32_t thread) {
+		ThreadScratch& scratch = m_threadScratch[thread];
+		uint32_t sameLevelCount;
+		for (uint32_t i = begin; i < end; ++i) {
+			if (awake[i] || gridLevel[i] >= topAwakeLevel) continue;
+			float px = posX[i] + velX[i];
+			float py = posY[i] + velY[i];
+			float pz = posZ[i] + velZ[i];
+			m_grid.query(px, py, pz, gridLevel[i] + 1u, scratch.nearby, sameLevelCount);
+
+			for (uint32_t j : scratch.nearby) {
+				if (!awake[j] || !PredictedBoxesOverlap(i, j)) continue;
+				AddCandidate(i, j, scratch);
+			}
 		}
-		else if (shapeJType == T_CYLINDER) {
-			dsqr = dx * dx + dz * dz;
+		FlushCandidates(scratch);
+	});
+}
 
-			if (dx > (size1p0div2)) { hasCollision = false; }
-			else if (dy > (size1p0div2)) { hasCollision = false; }
-			else if (dz > (size1p0div2)) { hasCollision = false; }
-			else if ((dsqr <= ((size1p0div2) * (size1p0div2)) && dy <= (size1div2))) { hasCollision = true; }
-			else {
-				dsqr = dx * dx + dy * dy + dz * dz;
-				hasCollision = (dsqr <= (size0div2 + SQRT_2 * size1div2) * (size0div2 + SQRT_2 * size1div2));
+void DynamicShapeArray::FindTreeContacts() {
+	UpdateAABBTree();
+	m_threadPool.parallelFor(0, (uint32_t)m_awakeBodies.size(), 256, [this](uint32_t begin, uint32_t end, uint32_t thread) {
+		ThreadScratch& scratch = m_threadScratch[thread];
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = m_awakeBodies[k];
+			scratch.nearby.clear();
+			m_AABBTree.query(GetPredictedAABB(i), [&scratch](uint32_t j) { scratch.nearby.push_back(j); });
+			for (uint32_t j : scratch.nearby) {
+				if (j <= i && bodies.awake[j]) continue; // avoid double checks, sleeping bodies don't query
+				AddCandidate(i, j, scratch);
 			}
 		}
+		FlushCandidates(scratch);
+	});
+}
+
+// Creates proxies for new bodies and moves the rest. Only bodies that left their fat box touch the tree.
+void DynamicShapeArray::UpdateAABBTree() {
+	if (m_treeProxies.size() < size) {
+		m_treeProxies.resize(size, DynamicAABBTree::NULL_NODE);
 	}
-	else if (shapeIType == T_CUBE) {
-		if (shapeJType == T_CUBE) {
-			hasCollision = dx <= size1p0div2 && dy <= size1p0div2 && dz <= size1p0div2 && (dx >= size10div2 || dy >= size10div2 || dz >= size10div2);
+	for (uint32_t i = 2; i < size; ++i) {
+		AABB box = GetPredictedAABB(i);
+		if (m_treeProxies[i] == DynamicAABBTree::NULL_NODE) {
+			m_treeProxies[i] = m_AABBTree.createProxy(box, i);
+		}
+		else {
+			m_AABBTree.moveProxy(m_treeProxies[i], box, bodies.velX[i], bodies.velY[i], bodies.velZ[i]);
 		}
 	}
-	else if (shapeIType == T_CYLINDER) {
-		if (shapeJType == T_CUBE) {
-			if (dx >= (size1p0div2)) { hasCollision = false; }
-			else if (dy >= (size1p0div2)) { hasCollision = false; }
-			else if (dz >= (size1p0div2)) { hasCollision = false; }
-			//be completely in 
-			else if ((dx < size10div2 && (dy < size10div2) && (dz < size10div2))) { hasCollision = false; }
+}
 
-			else if (dx < (size1div2)) { hasCollision = true; }
-			else if (dy < (size1div2)) { hasCollision = true; }
-			else if (dz < (size1div2)) { hasCollision = true; }
-			else {
-				float cornerDistance_sq = ((dx - size1div2) * (dx - size1div2)) +
-					((dy - size1div2) * (dy - size1div2)) +
-					((dz - size1div2) * (dz - size1div2));
-				hasCollision = (cornerDistance_sq < (size0* size0div2));
+// Same box CheckCollisionPair uses for its early out
+AABB DynamicShapeArray::GetPredictedAABB(uint32_t index) const {
+	float half = bodies.d[index] * .5f;
+	float px = bodies.posX[index] + bodies.velX[index];
+	float py = bodies.posY[index] + bodies.velY[index];
+	float pz = bodies.posZ[index] + bodies.velZ[index];
+	return AABB{ { px - half, py - half, pz - half }, { px + half, py + half, pz + half } };
+}
+
+// Boxes are the same ones CheckCollisionPair uses for its early out, so every pair that
+// can collide is a candidate, whatever its size.
+void DynamicShapeArray::FindSweepAndPruneContacts() {
+	for (uint32_t i = 2; i < size; ++i) {
+		AABB box = GetPredictedAABB(i);
+		m_SweepAndPrune.setBox(i, box.min[0], box.min[1], box.min[2], box.max[0], box.max[1], box.max[2]);
+	}
+	m_SweepAndPrune.findPairs(m_candidatePairs);
+
+	m_threadPool.parallelFor(0, (uint32_t)m_candidatePairs.size(), 1024, [this](uint32_t begin, uint32_t end, uint32_t thread) {
+		ThreadScratch& scratch = m_threadScratch[thread];
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = m_candidatePairs[k].first, j = m_candidatePairs[k].second;
+			if (!bodies.awake[i] && !bodies.awake[j]) continue;
+			AddCandidate(i, j, scratch);
+		}
+		FlushCandidates(scratch);
+	});
+}
+
+// Buckets a candidate pair by shape types, the batch kernels test it in FlushCandidates
+void DynamicShapeArray::AddCandidate(uint32_t i, uint32_t j, ThreadScratch& scratch) {
+	// same type pairs resolve in argument order, so every broadphase hands them over ascending
+	if (j < i) std::swap(i, j);
+	if (!bodies.awake[i] || !bodies.awake[j]) {
+		if (PredictedBoxesOverlap(i, j)) {
+			scratch.wake.push_back(bodies.awake[i] ? j : i);
+		}
+	}
+	if (m_pairCache.trySkip(i, j, bodies.velX.data(), bodies.velY.data(), bodies.velZ.data())) {
+		return;
+	}
+	const NarrowPhase::PairEntry& entry = NarrowPhase::PAIR_TABLE[bodies.shapeType[i]][bodies.shapeType[j]];
+	if (entry.swap) scratch.batches[entry.kind].push(j, i);
+	else scratch.batches[entry.kind].push(i, j);
+}
+
+// Runs the batch kernels over the queued candidates and turns their hit masks into contacts
+void DynamicShapeArray::FlushCandidates(ThreadScratch& scratch) {
+	const NarrowPhase::BodyView view = GetBodyView();
+	for (uint32_t kind = 0; kind < NarrowPhase::PAIR_KIND_COUNT; ++kind) {
+		NarrowPhase::PairBatch& batch = scratch.batches[kind];
+		if (batch.size() == 0) continue;
+		NarrowPhase::TestBatch(static_cast<NarrowPhase::PairKind>(kind), view, batch);
+		for (uint32_t word = 0; word < batch.hitMask.size(); ++word) {
+			for (uint32_t bits = batch.hitMask[word]; bits != 0; bits &= bits - 1) {
+				uint32_t k = word * 32 + std::countr_zero(bits);
+				scratch.contacts.push_back(Contact{ batch.first[k], batch.second[k] });
 			}
 		}
-		else if (shapeJType == T_CYLINDER) {
-			dsqr = dx * dx + dz * dz;
-			if (dsqr > (size1p0div2) * (size1p0div2)) { hasCollision = false; }
-			else if (dy >= (size1p0div2)) { hasCollision = false; }
-			else if (dy < (size1div2)) { hasCollision = true; }
-			else {
-				dsqr = dx * dx + dy * dy + dz * dz;
-				hasCollision = dsqr <= (SQRT_2 * size0div2 + SQRT_2 * size1div2) * (SQRT_2 * size0 + SQRT_2 * size1div2);
+		for (uint32_t k = 0; k < batch.size(); ++k) {
+			bool hit = (batch.hitMask[k >> 5] >> (k & 31)) & 1u;
+			RecordPair(batch.first[k], batch.second[k], hit, scratch);
+		}
+		batch.clear();
+	}
+}
+
+NarrowPhase::BodyView DynamicShapeArray::GetBodyView() const {
+	return { bodies.posX.data(), bodies.posY.data(), bodies.posZ.data(),
+		bodies.velX.data(), bodies.velY.data(), bodies.velZ.data(), bodies.d.data() };
+}
+
+// Stores a narrowphase result in the pair cache, along with how far apart the predicted boxes are on a miss
+void DynamicShapeArray::RecordPair(uint32_t i, uint32_t j, bool hit, ThreadScratch& scratch) {
+	float gap = 0.f;
+	uint8_t axis = 0;
+	if (!hit) {
+		float half = (bodies.d[i] + bodies.d[j]) * .5f;
+		float separation[3] = {
+			std::abs((bodies.posX[i] + bodies.velX[i]) - (bodies.posX[j] + bodies.velX[j])) - half,
+			std::abs((bodies.posY[i] + bodies.velY[i]) - (bodies.posY[j] + bodies.velY[j])) - half,
+			std::abs((bodies.posZ[i] + bodies.velZ[i]) - (bodies.posZ[j] + bodies.velZ[j])) - half };
+		gap = separation[0];
+		for (uint8_t k = 1; k < 3; ++k) {
+			if (separation[k] > gap) {
+				gap = separation[k];
+				axis = k;
 			}
 		}
 	}
-	else if (shapeIType == T_RING) {
-		float radi = size0 - (2 * size02), radB = size0;
-
-		if (shapeJType == T_CUBE) {
-			if (dx >= (size1p0div2)) { hasCollision = false; }
-			else if (dy >= (size1p0div2)) { hasCollision = false; }
-			else if (dz >= (size1p0div2)) { hasCollision = false; }
-			//be completely in 
-			else if ((dx < size10div2 && (dy < size10div2) && (dz < size10div2))) { hasCollision = false; }
-
-			else if (dx < (size1div2)) { hasCollision = true; }
-			else if (dy < (size1div2) + size02) { hasCollision = true; }
-			else if (dz < (size1div2)) { hasCollision = true; }
-			else {
-				
-				float cornerDistance_sq = ((dx - size1div2) * (dx - size1div2)) +
-					((dy - size1div2) * (dy - size1div2)) +
-					((dz - size1div2) * (dz - size1div2));
-				hasCollision = true;
+	m_pairCache.record(i, j, hit, gap, axis, scratch.pendingPairs);
+}
+
+bool DynamicShapeArray::PredictedBoxesOverlap(uint32_t i, uint32_t j) const {
+	float half = (bodies.d[i] + bodies.d[j]) * .5f;
+	return std::abs((bodies.posX[i] + bodies.velX[i]) - (bodies.posX[j] + bodies.velX[j])) <= half &&
+		std::abs((bodies.posY[i] + bodies.velY[i]) - (bodies.posY[j] + bodies.velY[j])) <= half &&
+		std::abs((bodies.posZ[i] + bodies.velZ[i]) - (bodies.posZ[j] + bodies.velZ[j])) <= half;
+}
+
+/*
+Sleeping
+- a body that stays slower than m_sleepSpeed for m_sleepTime seconds is stopped and leaves m_awakeBodies
+- WakeBody gives it back the speed it had, so a woken body carries on instead of staying behind
+  as a static obstacle
+- sleeping bodies stay in the broadphase structures but don't query them, so pairs of sleeping
+  bodies cost nothing. Their contacts are kept in the pair cache as they were.
+*/
+void DynamicShapeArray::WakeBody(uint32_t index) {
+	if (bodies.awake[index]) return;
+	bodies.awake[index] = 1;
+	bodies.sleepTimer[index] = 0.f;
+	bodies.velX[index] = bodies.sleepVelX[index];
+	bodies.velY[index] = bodies.sleepVelY[index];
+	bodies.velZ[index] = bodies.sleepVelZ[index];
+	m_pairCache.touchBody(index);
+	m_awakeDirty = true;
+}
+
+void DynamicShapeArray::UpdateSleep(float deltaTime) {
+	if (m_sleepTime <= 0.f) return;
+	float limit = m_sleepSpeed * m_sleepSpeed;
+	for (uint32_t i : m_awakeBodies) {
+		float speedSq = bodies.velX[i] * bodies.velX[i] + bodies.velY[i] * bodies.velY[i] + bodies.velZ[i] * bodies.velZ[i];
+		if (speedSq >= limit) {
+			bodies.sleepTimer[i] = 0.f;
+			continue;
+		}
+		bodies.sleepTimer[i] += deltaTime;
+		if (bodies.sleepTimer[i] >= m_sleepTime) {
+			bodies.awake[i] = 0;
+			bodies.sleepVelX[i] = bodies.velX[i];
+			bodies.sleepVelY[i] = bodies.velY[i];
+			bodies.sleepVelZ[i] = bodies.velZ[i];
+			bodies.velX[i] = 0.f;
+			bodies.velY[i] = 0.f;
+			bodies.velZ[i] = 0.f;
+			m_pairCache.touchBody(i);
+			m_fellAsleep.push_back(i);
+			m_awakeDirty = true;
+		}
+	}
+	if (m_awakeDirty) RebuildAwakeList();
+}
+
+void DynamicShapeArray::RebuildAwakeList() {
+	m_awakeBodies.clear();
+	for (uint32_t i = 2; i < size; ++i) {
+		if (bodies.awake[i]) m_awakeBodies.push_back(i);
+	}
+	m_awakeDirty = false;
+}
+
+/*
+Continuous collision
+- with large steps (high speedUP, long frames) a body can move further than its own size in one
+  step and pass through other bodies or the enclosure walls
+- bodies that move more than half their extent are swept: every box is stretched over the step
+  and run through a separate sweep and prune, and pairs with a swept body get a time of impact.
+  Sphere pairs are solved exactly, pairs with any other shape as boxes.
+- both bodies of a pair only advance to their earliest impact, so the regular narrowphase finds
+  the contact and Collide resolves it. The rest of their step is dropped.
+- every body stops at the world box walls the same way
+*/
+bool DynamicShapeArray::SweepContinuous(float speedFactor) {
+	m_sweptBodies.assign(size, 0);
+	m_timeOfImpact.assign(size, 1.f);
+	bool anySwept = false;
+	bool anyImpact = false;
+	for (uint32_t i : m_awakeBodies) {
+		float half = bodies.d[i] * .5f;
+		float motion[3] = { bodies.velX[i] * speedFactor, bodies.velY[i] * speedFactor, bodies.velZ[i] * speedFactor };
+
+		// world box walls for every body. A body that is already past a wall doesn't move further out.
+		float pos[3] = { bodies.posX[i], bodies.posY[i], bodies.posZ[i] };
+		for (int axis = 0; axis < 3; ++axis) {
+			if (motion[axis] == 0.f) continue;
+			float distance = (motion[axis] > 0.f ? m_worldBox.max[axis] - half : m_worldBox.min[axis] + half) - pos[axis];
+			float t = distance / motion[axis];
+			if (t < 1.f) {
+				m_timeOfImpact[i] = std::min(m_timeOfImpact[i], t > 0.f ? t : 0.f);
+				anyImpact = true;
 			}
+		}
 
+		if (std::abs(motion[0]) > half || std::abs(motion[1]) > half || std::abs(motion[2]) > half) {
+			m_sweptBodies[i] = 1;
+			anySwept = true;
+		}
+	}
+	if (!anySwept) {
+		if (!anyImpact) return false;
+		for (uint32_t i : m_awakeBodies) {
+			if (m_timeOfImpact[i] < 1.f) m_pairCache.touchBody(i);
 		}
-		else if (shapeJType == T_CYLINDER) {
-			hasCollision = false;
+		return true;
+	}
+
+	// body 1 (hero sphere) only takes part as an obstacle, body 0 is handled by the walls above
+	for (uint32_t i = 1; i < size; ++i) {
+		float half = bodies.d[i] * .5f;
+		float start[3] = { bodies.posX[i], bodies.posY[i], bodies.posZ[i] };
+		float end[3] = { start[0], start[1], start[2] };
+		if (bodies.awake[i] && i >= 2) {
+			end[0] += bodies.velX[i] * speedFactor;
+			end[1] += bodies.velY[i] * speedFactor;
+			end[2] += bodies.velZ[i] * speedFactor;
 		}
-		else if (shapeJType == T_SPHERE) {
-			dsqr = dx * dx + dz * dz;
+		m_sweptSAP.setBox(i,
+			std::min(start[0], end[0]) - half, std::min(start[1], end[1]) - half, std::min(start[2], end[2]) - half,
+			std::max(start[0], end[0]) + half, std::max(start[1], end[1]) + half, std::max(start[2], end[2]) + half);
+	}
+	m_sweptSAP.findPairs(m_sweptPairs);
 
-			if (dx > (size1div2 + size0)) { hasCollision = false; }
-			else if (dy > (size1div2 + size0)) { hasCollision = false; }
-			else if (dz > (size1div2 + size0)) { hasCollision = false; }
-			else if ((dsqr <= (((size0)+(size1div2)) * ((size1div2) + (size0))) && dy <= (size1div2))) { hasCollision = true; }
-			else {
-				dsqr = dx * dx + dy * dy + dz * dz;
-				hasCollision = (dsqr <= (size0div2 + SQRT_2 * size1div2) * (size0div2 + SQRT_2 * size1div2));
+	for (ThreadScratch& scratch : m_threadScratch) {
+		scratch.impacts.clear();
+	}
+	m_threadPool.parallelFor(0, (uint32_t)m_sweptPairs.size(), 1024, [this, speedFactor](uint32_t begin, uint32_t end, uint32_t thread) {
+		ThreadScratch& scratch = m_threadScratch[thread];
+		for (uint32_t k = begin; k < end; ++k) {
+			uint32_t i = m_sweptPairs[k].first, j = m_sweptPairs[k].second;
+			if (!m_sweptBodies[i] && !m_sweptBodies[j]) continue;
+			float t = TimeOfImpact(i, j, speedFactor);
+			if (t < 1.f) {
+				scratch.impacts.push_back({ i, t });
+				scratch.impacts.push_back({ j, t });
 			}
 		}
-		else if (shapeJType == T_RING) {
-			hasCollision = false;
+	});
+	// the earliest impact wins, which doesn't depend on the order the threads found them in
+	for (const ThreadScratch& scratch : m_threadScratch) {
+		for (const std::pair<uint32_t, float>& impact : scratch.impacts) {
+			m_timeOfImpact[impact.first] = std::min(m_timeOfImpact[impact.first], impact.second);
+		}
+	}
+	for (uint32_t i : m_awakeBodies) {
+		if (m_timeOfImpact[i] < 1.f) {
+			m_pairCache.touchBody(i); // it doesn't move by its full speed this step
 		}
 	}
+	return true;
+}
+
+// Fraction of the step at which the bodies first touch, 1 if they don't. Pairs that already
+// overlap at the start are left to the discrete test.
+float DynamicShapeArray::TimeOfImpact(uint32_t i, uint32_t j, float speedFactor) const {
+	auto motion = [&](uint32_t index, const std::vector<float>& vel) {
+		return bodies.awake[index] && index >= 2 ? vel[index] * speedFactor : 0.f;
+	};
+	float p[3] = { bodies.posX[j] - bodies.posX[i], bodies.posY[j] - bodies.posY[i], bodies.posZ[j] - bodies.posZ[i] };
+	float v[3] = { motion(j, bodies.velX) - motion(i, bodies.velX),
+		motion(j, bodies.velY) - motion(i, bodies.velY),
+		motion(j, bodies.velZ) - motion(i, bodies.velZ) };
+	float reach = (bodies.d[i] + bodies.d[j]) * .5f;
+
+	if (bodies.shapeType[i] == T_SPHERE && bodies.shapeType[j] == T_SPHERE) {
+		float a = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+		float b = 2.f * (p[0] * v[0] + p[1] * v[1] + p[2] * v[2]);
+		float c = p[0] * p[0] + p[1] * p[1] + p[2] * p[2] - reach * reach;
+		if (c <= 0.f || a == 0.f || b >= 0.f) return 1.f;
+		float discriminant = b * b - 4.f * a * c;
+		if (discriminant < 0.f) return 1.f;
+		float t = (-b - std::sqrt(discriminant)) / (2.f * a);
+		return t < 1.f ? t : 1.f;
+	}
 
-	if (hasCollision) {
-		Collide(i, j);
-		Collide(j, i);
-#ifdef _WIN32
-		// Play sound on collision for the first 5 shapes only to avoid sound spam
-		if (i <= 5 && soundsEnabled) {
-			PlaySound(TEXT("collision.wav"), NULL, SND_FILENAME | SND_ASYNC);
+	// boxes: the interval of every axis on which the distance is within reach
+	float enter = 0.f, exit = 1.f;
+	bool overlapsAtStart = true;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (std::abs(p[axis]) >= reach) overlapsAtStart = false;
+		if (v[axis] == 0.f) {
+			if (std::abs(p[axis]) >= reach) return 1.f;
+			continue;
 		}
-#endif
+		float t0 = (-reach - p[axis]) / v[axis];
+		float t1 = (reach - p[axis]) / v[axis];
+		if (t0 > t1) std::swap(t0, t1);
+		enter = std::max(enter, t0);
+		exit = std::min(exit, t1);
+		if (enter >= exit) return 1.f; // also touching boxes that move apart
+	}
+	if (overlapsAtStart) return 1.f;
+	return enter < 1.f ? enter : 1.f;
+}
+
+// Merges the per-thread contact lists and resolves them in body pair order
+void DynamicShapeArray::ResolveContacts() {
+	m_contacts.clear();
+	for (const ThreadScratch& scratch : m_threadScratch) {
+		m_contacts.insert(m_contacts.end(), scratch.contacts.begin(), scratch.contacts.end());
+	}
+	std::sort(m_contacts.begin(), m_contacts.end(), [](const Contact& a, const Contact& b) {
+		return a.sortKey() < b.sortKey();
+	});
+	for (const Contact& contact : m_contacts) {
+		ResolveCollision(contact.first, contact.second, m_stepEvents);
+	}
+}
+
+void DynamicShapeArray::CheckCollisionPair(int i, int j, std::vector<CollisionEvent>& events) {
+	uint32_t first, second;
+	if (TestCollisionPair(i, j, first, second)) {
+		ResolveCollision(first, second, events);
+	}
+}
+
+/*
+Narrowphase
+- only reads body state, so it is safe to run from several threads
+- on a hit, first and second receive the pair in the canonical order ResolveCollision expects
+- the shape types pick the test from NarrowPhase::PAIR_TABLE, this is the single pair version of
+  the batch kernels
+*/
+bool DynamicShapeArray::TestCollisionPair(int i, int j, uint32_t& first, uint32_t& second) const {
+	const NarrowPhase::PairEntry& entry = NarrowPhase::PAIR_TABLE[bodies.shapeType[i]][bodies.shapeType[j]];
+	first = entry.swap ? j : i;
+	second = entry.swap ? i : j;
+	return NarrowPhase::TestPair(entry.kind, GetBodyView(), first, second);
+}
+
+// Applies the response to a narrowphase hit. With the event queue enabled, the hit is described
+// in events first, from the speeds before the response.
+void DynamicShapeArray::ResolveCollision(uint32_t first, uint32_t second, std::vector<CollisionEvent>& events) {
+	if (m_collisionEvents.enabled()) {
+		const float dA = bodies.d[first], dB = bodies.d[second];
+		const float t = dA / (dA + dB);
+		const float dvx = bodies.velX[first] - bodies.velX[second];
+		const float dvy = bodies.velY[first] - bodies.velY[second];
+		const float dvz = bodies.velZ[first] - bodies.velZ[second];
+		CollisionEvent event;
+		event.step = m_stepCount;
+		event.bodyA = first;
+		event.bodyB = second;
+		event.shapeTypeA = static_cast<uint8_t>(bodies.shapeType[first]);
+		event.shapeTypeB = static_cast<uint8_t>(bodies.shapeType[second]);
+		event.pairKind = static_cast<uint8_t>(NarrowPhase::PAIR_TABLE[bodies.shapeType[first]][bodies.shapeType[second]].kind);
+		event.point[0] = bodies.posX[first] + (bodies.posX[second] - bodies.posX[first]) * t;
+		event.point[1] = bodies.posY[first] + (bodies.posY[second] - bodies.posY[first]) * t;
+		event.point[2] = bodies.posZ[first] + (bodies.posZ[second] - bodies.posZ[first]) * t;
+		event.relativeSpeed = std::sqrt(dvx * dvx + dvy * dvy + dvz * dvz);
+		events.push_back(event);
+	}
+	Collide(first, second);
+	Collide(second, first);
+}
+
+// Hands the collisions of the step to the event queue in body pair order, whatever thread found them
+void DynamicShapeArray::PublishCollisionEvents() {
+	// hits of MoveSphere calls since the last step count as this step's
+	bool unsorted = m_carriedEvents > 0;
+	for (uint32_t k = 0; k < m_carriedEvents; ++k) {
+		m_stepEvents[k].step = m_stepCount;
+	}
+	m_carriedEvents = 0;
+	for (ThreadScratch& scratch : m_threadScratch) {
+		unsorted |= !scratch.events.empty();
+		m_stepEvents.insert(m_stepEvents.end(), scratch.events.begin(), scratch.events.end());
+		scratch.events.clear();
+	}
+	if (unsorted) {
+		std::stable_sort(m_stepEvents.begin(), m_stepEvents.end(), [](const CollisionEvent& a, const CollisionEvent& b) {
+			return Contact{ a.bodyA, a.bodyB }.sortKey() < Contact{ b.bodyA, b.bodyB }.sortKey();
+		});
+	}
+	if (!m_stepEvents.empty()) {
+		m_collisionEvents.push(m_stepEvents.data(), static_cast<uint32_t>(m_stepEvents.size()));
+		m_stepEvents.clear();
 	}
 }
 
@@ -441,17 +1135,19 @@ void DynamicShapeArray::CheckCollisionPair(int i, int j) {
 */
 // TODO: FIX THE SIZE STUFF, it's horrifying it works remotely well
 void DynamicShapeArray::Collide(int index1, int index2) {
-	Shape& shape1 = *shapeArray[index1];
-	Shape& shape2 = *shapeArray[index2];
-	if (shape2.speed[0] == 0 && shape2.speed[1] == 0 && shape2.speed[2] == 0) {
+	// only the speed of the second body is written
+	float& speed2X = bodies.velX[index2];
+	float& speed2Y = bodies.velY[index2];
+	float& speed2Z = bodies.velZ[index2];
+	if (speed2X == 0 && speed2Y == 0 && speed2Z == 0) {
 		return;
 	}
+	m_pairCache.touchBody(index2);
 
-	int shapeType2 = shape2.shapeType;
-	int shapeType1 = shape1.shapeType;
-	float* pos = shape1.center;
-	float* pos1 = shape2.center;
-	glm::vec3 speed(shape2.speed[0], shape2.speed[1], shape2.speed[2]);
+	int shapeType1 = bodies.shapeType[index1];
+	float pos[3] = { bodies.posX[index1], bodies.posY[index1], bodies.posZ[index1] };
+	float pos1[3] = { bodies.posX[index2], bodies.posY[index2], bodies.posZ[index2] };
+	glm::vec3 speed(speed2X, speed2Y, speed2Z);
 	glm::vec3 Tspeed(0.0f, 0.0f, 0.0f);
 	float dx = pos[0] - pos1[0];
 	float dy = pos[1] - pos1[1];
@@ -465,9 +1161,9 @@ void DynamicShapeArray::Collide(int index1, int index2) {
 
 		speed = glm::length(speed) * normalize((-centerToCenter) * glm::dot(Tspeed, centerToCenter));
 
-		shape2.speed[0] = speed[0];
-		shape2.speed[1] = speed[1];
-		shape2.speed[2] = speed[2];
+		speed2X = speed[0];
+		speed2Y = speed[1];
+		speed2Z = speed[2];
 	}
 	if (shapeType1 == T_CUBE) {
 		glm::vec3 X(1.0f, 0.0f, 0.0f);
@@ -478,16 +1174,16 @@ void DynamicShapeArray::Collide(int index1, int index2) {
 
 		centerToCenter = glm::normalize(centerToCenter);
 		float dists[3] = { glm::dot(centerToCenter,X),  glm::dot(centerToCenter,Y),  glm::dot(centerToCenter,Z) };
-		float m = abs(dists[0]);
-		m = std::max(m, abs(dists[1]));
-		m = std::max(m, abs(dists[2]));
-
-		if (m == abs(dists[0])) {
-			shape2.speed[0] = -speed[0];
-		}if (m == abs(dists[1])) {
-			shape2.speed[1] = -speed[1];
-		}if (m == abs(dists[2])) {
-			shape2.speed[2] = -speed[2];
+		float m = std::abs(dists[0]);
+		m = std::max(m, std::abs(dists[1]));
+		m = std::max(m, std::abs(dists[2]));
+
+		if (m == std::abs(dists[0])) {
+			speed2X = -speed[0];
+		}if (m == std::abs(dists[1])) {
+			speed2Y = -speed[1];
+		}if (m == std::abs(dists[2])) {
+			speed2Z = -speed[2];
 		}
 	}
 	if (shapeType1 == T_CYLINDER) {
@@ -497,24 +1193,24 @@ void DynamicShapeArray::Collide(int index1, int index2) {
 
 		glm::vec3 centerToCenter(dx, dy, dz);
 		// WOWZIES THIS IS SUPER WRONG. SIZE IS THE ELEMENT BUFFER SIZE NOT THE RADIUS OR HEIGHT
-		float size1 = shape1.d / 2;
+		float size1 = bodies.d[index1] / 2;
 		//float size2 = shape2.size / 2;
 		Tspeed = glm::normalize(speed);
 		centerToCenter = glm::normalize(centerToCenter);
 		glm::vec3 ctc2(centerToCenter[0], 0, centerToCenter[2]);
-		float dists[2] = { cos((acos(abs(glm::dot(centerToCenter,X))) + acos(abs(glm::dot(centerToCenter,Z)))) / 2),  glm::dot(centerToCenter,Y) };
-		float m = abs(dists[1]);
-		m = std::max(m, abs(dists[0]));
+		float dists[2] = { cos((acos(std::abs(glm::dot(centerToCenter,X))) + acos(std::abs(glm::dot(centerToCenter,Z)))) / 2),  glm::dot(centerToCenter,Y) };
+		float m = std::abs(dists[1]);
+		m = std::max(m, std::abs(dists[0]));
 
 		if ((dists[1] >= SQRT_2 / 2 && dists[1] < 1) || (dists[1] <= -SQRT_2 / 2 && dists[1] > -1)) {
-			shape2.speed[1] = -speed[1];
+			speed2Y = -speed[1];
 
 		}
 		else if (dy < size1) {
 
 			Tspeed = glm::length(speed) * normalize((-centerToCenter) * glm::dot(Tspeed, centerToCenter));
-			shape2.speed[0] = Tspeed[0];
-			shape2.speed[2] = Tspeed[2];
+			speed2X = Tspeed[0];
+			speed2Z = Tspeed[2];
 		}
 	}
 	if (shapeType1 == T_RING) {
@@ -522,31 +1218,31 @@ void DynamicShapeArray::Collide(int index1, int index2) {
 		glm::vec3 Y(0.0f, 1.0f, 0.0f);
 		glm::vec3 Z(0.0f, 0.0f, 1.0f);
 
-		float s1 = shape1.d;
-		float s2 = shape1.d2;
+		float s1 = bodies.d[index1];
+		float s2 = bodies.d2[index1];
 
 
 		glm::vec3 centerToCenter(dx - s1 - s2, dy, dz - s1 - s2);
 		// WOWZIES THIS IS SUPER WRONG. SIZE IS THE ELEMENT BUFFER SIZE NOT THE RADIUS OR HEIGHT
-		float size1 = shape1.d / 2.f;
+		float size1 = bodies.d[index1] / 2.f;
 		//float size2 = shape2.d / 2.f;
 		Tspeed = glm::normalize(speed);
 		centerToCenter = glm::normalize(centerToCenter);
 		glm::vec3 ctc2(centerToCenter[0], 0, centerToCenter[2]);
-		float dists[2] = { cos((acos(abs(glm::dot(centerToCenter,X))) + acos(abs(glm::dot(centerToCenter,Z)))) / 2),  glm::dot(centerToCenter,Y) };
-		float m = abs(dists[1]);
-		m = std::max(m, abs(dists[0]));
+		float dists[2] = { cos((acos(std::abs(glm::dot(centerToCenter,X))) + acos(std::abs(glm::dot(centerToCenter,Z)))) / 2),  glm::dot(centerToCenter,Y) };
+		float m = std::abs(dists[1]);
+		m = std::max(m, std::abs(dists[0]));
 
 		if ((dists[1] >= SQRT_2 / 2 && dists[1] < 1) || (dists[1] <= -SQRT_2 / 2 && dists[1] > -1)) {
-			shape2.speed[1] = -speed[1];
+			speed2Y = -speed[1];
 
 		}
 		else if (dy < size1) {
 
 			Tspeed = glm::length(speed) * normalize((-centerToCenter) * glm::dot(Tspeed, centerToCenter));
-			shape2.speed[1] = Tspeed[1];
-			shape2.speed[0] = Tspeed[0];
-			shape2.speed[2] = Tspeed[2];
+			speed2Y = Tspeed[1];
+			speed2X = Tspeed[0];
+			speed2Z = Tspeed[2];
 		}
 	}
 }
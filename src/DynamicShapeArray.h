@@ -1,12 +1,46 @@
 #pragma once
 #include "ShapeFactory.h"
-#include "SpatialGrid.h"
+#include "HierarchicalGrid.h"
+#include "BodyStore.h"
+#include "SweepAndPrune.h"
+#include "DynamicAABBTree.h"
+#include "ThreadPool.h"
+#include "NarrowPhase.h"
+#include "PairCache.h"
+#include "RadixSorter.h"
+#include "CollisionEventQueue.h"
+#include "Transforms.h"
 
 #define GLOBAL_SPEED 30
 #define MAX_SPEEDUP 100
+#define SLEEP_SPEED 0.01f // bodies slower than this for SLEEP_TIME seconds fall asleep
+#define SLEEP_TIME 0.5f
+#define GRID_HYSTERESIS 0.1f // fraction of a cell an incremental grid body may stray from its cell before it is moved
+#define COLLISION_EVENT_CAPACITY 4096 // events the queue holds when it is enabled without a capacity
+#define CULL_CELL_SIZE 10.f // cells of the CPU culling grid, 1000 of them in the default world box
 
 extern bool soundsEnabled;
 
+enum BroadphaseType {
+	BROADPHASE_GRID = 0, // hierarchical grid, every body on the level that fits its size
+	BROADPHASE_SAP,      // sweep and prune over every movable body
+	BROADPHASE_TREE,     // every movable body queried against the AABB tree
+	BROADPHASE_COUNT
+};
+
+// A narrowphase hit, in the order Collide has to be called in
+struct Contact {
+	uint32_t first;
+	uint32_t second;
+
+	// identifies the body pair regardless of order
+	inline uint64_t sortKey() const {
+		uint32_t lo = first < second ? first : second;
+		uint32_t hi = first < second ? second : first;
+		return (static_cast<uint64_t>(lo) << 32) | hi;
+	}
+};
+
 class DynamicShapeArray
 {
 public:
@@ -24,40 +58,154 @@ public:
 
 	// Updater (If this project gets bigger(very funny), split into IntegrateMotion, UpdatePhysics, UpdateMatrices).
 	void UpdatePhysics(float deltaTime);
-	void UpdateMatrices(const glm::mat4& view, const glm::mat4& projection);
+	// alpha blends from the state before the last physics step (0) to the current one (1)
+	void UpdateMatrices(const glm::mat4& view, const glm::mat4& projection, float alpha = 1.f);
+	// Only the hero sphere (body 1), for renderers that draw the other bodies from instances
+	void UpdateHeroMatrices(const glm::mat4& view, const glm::mat4& projection);
+	// CPU frustum culling of the movable bodies at their alpha blended centers, for renderers without GPU culling.
+	// typeRadius is the bounding radius of each shape type's mesh, a body's sphere is it times the body's largest scale.
+	void CullBodies(const glm::vec4 planes[6], const float typeRadius[SHAPE_TYPE_COUNT], float alpha = 1.f);
 
 	void MoveSphere(int index, glm::vec3 speed);
 	void SpeedUP(bool up);
+	void SetSpeedUP(int value); // clamped to [0, MAX_SPEEDUP]
+	void SetBroadphase(BroadphaseType type);
+	void CycleBroadphase();
+	void SetThreadCount(uint32_t threadCount); // 0 = one per hardware thread
+	void SetRandomSeed(uint32_t seed);
+	void SetSleepParameters(float speed, float time); // time <= 0 disables sleeping
+	void SetContinuousCollision(bool enabled);
+	void SetIncrementalGrid(bool enabled, float hysteresis = GRID_HYSTERESIS); // keeps the grid between steps, only moving bodies that change cells
+	void ToggleContinuousCollision();
+	void SetReorderInterval(uint32_t frames); // sorts bodies in Morton order every frames physics steps, 0 disables
+	void ReorderBodies();
+	void SetWorldBox(const glm::vec3& min, const glm::vec3& max); // inside of the enclosure, [0, 100] on every axis by default
+	void SetCollisionEventCapacity(uint32_t capacity = COLLISION_EVENT_CAPACITY); // 0 disables the collision events (default)
 
 	//Getters
 	inline uint32_t getSize() { return size; };
 	inline uint64_t getShapeTypeArraySize(int16_t shape) { return shapeTypeArray[shape].size(); };
-	inline glm::mat4 getModel(int index) { return shapeArray[index]->matrices.model; };
-	inline glm::mat4 getNormalModel(int index) { return shapeArray[index]->matrices.normalModel; };
+	inline uint32_t getVisibleCount(int shapeType) const { return static_cast<uint32_t>(m_visibleBodies[shapeType].size()); }; // of the last CullBodies
+	inline glm::mat4 getModel(int index) { return bodies.matrices[index].model; };
+	inline glm::mat4 getNormalModel(int index) { return bodies.matrices[index].normalModel; };
+	inline const BodyStore& getBodies() const { return bodies; };
+	inline uint32_t getThreadCount() const { return m_threadPool.getThreadCount(); };
+	inline const NarrowPhase::WorldBox& getWorldBox() const { return m_worldBox; };
+	inline uint32_t getAwakeCount() const { return static_cast<uint32_t>(m_awakeBodies.size()); };
+	// begin/persist/end transitions of the last step, sorted by body pair
+	inline const std::vector<ContactEvent>& getContactEvents() const { return m_pairCache.getEvents(); };
+	// resolved collisions of every step, for one consumer that may drain them from another thread
+	inline CollisionEventQueue& getCollisionEvents() { return m_collisionEvents; };
 	float * GetColor(uint32_t index);//Returns the color of the shape to pass into the shader
 	uint32_t GetIndexPointerSize(uint32_t shapeType);//Returns the size of the ib to use when drawing
 	void uploadMatricesToPtr(int shapeType, uint16_t type, void* ptr); // uploads all matrices of a shape type to a mapped ssbo pointer
-	void uploadColorsToPtr(int shapeType, uint16_t type, void* ptr); // uploads all colors of a shape type to a mapped ssbo pointer
+	void uploadInstancesToPtr(int shapeType, void* ptr, float alpha = 1.f); // uploads an InstanceData per body of a shape type, centers blended like UpdateMatrices
+	void uploadColorsToPtr(int shapeType, uint16_t type, void* ptr); // uploads all colors of a shape type as RGBA8 to a mapped ssbo pointer
+	void uploadVisibleInstancesToPtr(int shapeType, void* ptr); // like uploadInstancesToPtr, only the bodies the last CullBodies kept, compacted
+	void uploadVisibleColorsToPtr(int shapeType, void* ptr); // like uploadColorsToPtr, only the bodies the last CullBodies kept, compacted
 
 	//Setters
 	void SetColor(int index, float r_value, float g_value, float b_value, float alpha_value = 1.0f);
 	void SetRandomColor(int index, float alpha_value = 1.0f);
-	void setRenderer(OpenGLRenderer* renderer);
+	void SetSpeed(int index, const glm::vec3& speed);
+	void setRenderer(Renderer* renderer);
 
+	// Narrowphase for a single pair, only reads body state. On a hit first and second receive the
+	// pair in the order Collide has to be called in.
+	bool TestCollisionPair(int i, int j, uint32_t& first, uint32_t& second) const;
 
 private:
-	std::vector<Shape *> shapeArray;
-	std::array<std::vector<Shape*>, 4> shapeTypeArray; // for batch rendering 
+	BodyStore bodies;
+	ShapePool m_shapePool; // staging Shapes handed out by the factory
+	std::array<std::vector<uint32_t>, 4> shapeTypeArray; // body indices per shape type, for batch rendering
 	ShapeFactory* shapeFactory;
 	uint32_t size;
 	uint32_t capacity;
 	
 	//collision handling
-	SpatialGrid m_SpatialGrid{ 10.0f }; // cell size of 20 units
-	std::vector<uint32_t> m_nearbyCache;
+	NarrowPhase::WorldBox m_worldBox{ { 0.f, 0.f, 0.f }, { 100.f, 100.f, 100.f } };
+	std::vector<uint8_t> m_wallHits; // per awake list entry, the wall stage flipped the body's speed or clamped its position
+	HierarchicalGrid m_grid{ 2.0f }; // finest cell size, levels double from there
+	std::vector<uint8_t> m_gridLevel; // grid level per body index
+	uint32_t m_gridTracked = 0; // incremental grid: bodies below this index are in the grid, 0 = grid needs a reset
+	std::vector<uint8_t> m_gridMoves; // incremental grid: per awake list entry, body left its cell
+	std::vector<uint32_t> m_fellAsleep; // bodies stopped by UpdateSleep since the last collision pass
+	SweepAndPrune m_SweepAndPrune;
+	std::vector<std::pair<uint32_t, uint32_t>> m_candidatePairs;
+	BroadphaseType m_broadphase = BROADPHASE_GRID;
+	DynamicAABBTree m_AABBTree;
+	std::vector<int32_t> m_treeProxies; // proxy id per body index, bodies 0 and 1 have none
+
+	// parallel collision pipeline
+	struct ThreadScratch {
+		std::vector<uint32_t> nearby;
+		std::vector<Contact> contacts;
+		std::array<NarrowPhase::PairBatch, NarrowPhase::PAIR_KIND_COUNT> batches; // candidates waiting for the batch kernels
+		std::vector<PairCache::PendingPair> pendingPairs; // pairs the cache hasn't seen before
+		std::vector<uint32_t> wake; // sleeping bodies overlapped by an awake one
+		std::vector<std::pair<uint32_t, float>> impacts; // body and time of impact found by the swept test
+		std::vector<CollisionEvent> events; // hero sphere collisions of the wall pass
+	};
+	ThreadPool m_threadPool;
+	std::vector<ThreadScratch> m_threadScratch; // one per pool thread
+	std::vector<Contact> m_contacts; // merged and sorted contacts of the current step
+	PairCache m_pairCache;
+	float m_speedFactor = 0.f; // displacement per unit of speed of the last integration step
+	uint32_t m_stepCount = 0;
+
+	// collision events
+	CollisionEventQueue m_collisionEvents;
+	std::vector<CollisionEvent> m_stepEvents; // collisions resolved on the calling thread, published at the end of the step
+	uint32_t m_carriedEvents = 0; // hero sphere hits of MoveSphere at the front of m_stepEvents, they join the next step
+
+	// sleeping
+	std::vector<uint32_t> m_awakeBodies; // awake movable bodies, ascending
+	bool m_awakeDirty = false;
+	float m_sleepSpeed = SLEEP_SPEED;
+	float m_sleepTime = SLEEP_TIME;
+
+	// continuous collision
+	bool m_continuousCollision = false;
+	SweepAndPrune m_sweptSAP; // boxes stretched over the whole step
+	std::vector<std::pair<uint32_t, uint32_t>> m_sweptPairs;
+	std::vector<uint8_t> m_sweptBodies; // bodies moving more than half their extent this step
+	std::vector<float> m_timeOfImpact;  // fraction of the step each body advances, by body index
+
+	// CPU culling
+	SpatialGrid m_cullGrid{ CULL_CELL_SIZE }; // rebuilt by every CullBodies, dense over the world box
+	std::vector<glm::vec4> m_cullSpheres; // blended center and bounding radius by body index
+	std::array<std::vector<uint32_t>, SHAPE_TYPE_COUNT> m_visibleBodies; // body indices per shape type
+
+	// Morton order reordering
+	uint32_t m_reorderInterval = 0;
+	uint32_t m_framesSinceReorder = 0;
+	RadixSorter m_radixSorter;
+	std::vector<uint64_t> m_reorderKeys;    // Morton code << 32 | body index
+	std::vector<uint32_t> m_reorderOrder;   // old body index per new index
+	std::vector<uint32_t> m_reorderNewIndex; // new body index per old index
 
 	void CheckAllCollisions();
-	void CheckCollisionPair(int i, int j);
+	void UpdateGrid();
+	void FindGridContacts();
+	void FindSweepAndPruneContacts();
+	void FindTreeContacts();
+	void AddCandidate(uint32_t i, uint32_t j, ThreadScratch& scratch);
+	void FlushCandidates(ThreadScratch& scratch);
+	NarrowPhase::BodyView GetBodyView() const;
+	void RecordPair(uint32_t i, uint32_t j, bool hit, ThreadScratch& scratch);
+	void ResolveContacts();
+	void ResolveWalls();
+	bool PredictedBoxesOverlap(uint32_t i, uint32_t j) const;
+	void WakeBody(uint32_t index);
+	void UpdateSleep(float deltaTime);
+	void RebuildAwakeList();
+	bool SweepContinuous(float speedFactor);
+	float TimeOfImpact(uint32_t i, uint32_t j, float speedFactor) const;
+	void UpdateAABBTree();
+	AABB GetPredictedAABB(uint32_t index) const;
+	void CheckCollisionPair(int i, int j, std::vector<CollisionEvent>& events);
+	void ResolveCollision(uint32_t first, uint32_t second, std::vector<CollisionEvent>& events);
+	void PublishCollisionEvents();
 	void Collide(int index1, int index2);
 	
 	//assisting function
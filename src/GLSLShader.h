@@ -20,20 +20,25 @@ private:
 public:
 	GLSLShader(const std::filesystem::path& filepath);
 	GLSLShader(const std::filesystem::path& vertFilepath, const std::filesystem::path& fragFilepath);
+	// Single stage program from a .slang file, so far only GL_COMPUTE_SHADER (computeMain)
+	GLSLShader(const std::filesystem::path& filepath, uint32_t shaderType);
 	GLSLShader();
 	~GLSLShader();
 
 	void Bind() const;
 	void Unbind() const;
+	inline bool isValid() const { return m_RendererID != 0; } // false when compiling or linking failed
 
 private:
 	std::string ConvertSPIRVToGLSL(
 		const std::vector<uint8_t>& spirvBytes,
-		bool isVertexShader
+		uint32_t shaderType // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER or GL_COMPUTE_SHADER
 	);
 	void ParseShader(const std::filesystem::path& filepath);
+	void ParseComputeShader(const std::filesystem::path& filepath);
 	uint32_t CompileShader(uint32_t type, const std::string& source);
 	uint32_t CreateShader(const std::string& vertexGLSLShader, const std::string& fragmentGLSLShader);
+	uint32_t CreateComputeShader(const std::string& computeGLSLShader);
 	uint32_t CompileSpirVShader(uint32_t type, const std::vector<uint8_t>& SPV);
 	uint32_t CreateSpirVShader(const std::vector<uint8_t>& VertexSPV, const std::vector<uint8_t>& FragmentSPV);
 };
\ No newline at end of file
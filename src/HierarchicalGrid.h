@@ -0,0 +1,140 @@
+#pragma once
+#include "SpatialGrid.h"
+#include <vector>
+#include <cstdint>
+
+// Hierarchical grid: a stack of SpatialGrids whose cell size doubles from one level to the next.
+// Every object goes into the finest level whose cells are at least as large as its extent, so the
+// 3x3x3 cells around it on that level, or on any coarser one, hold everything it can touch.
+// Queries visit the object's own level and every coarser level that isn't empty. A pair on one
+// level is found by both objects, a pair across levels only by the object on the finer level.
+// Usage per frame: clear() -> insert() every object -> build() -> query().
+//
+// Incremental mode keeps objects between frames on linked levels. An object only moves once its
+// position is more than a hysteresis margin outside its cell. The margin is a fraction of the cell
+// size, but never more than half the room the object leaves in its cell, (cell - extent) / 2: a
+// stored object is then never further than its own cell size from anything it touches, and the
+// 3x3x3 search stays exact.
+// Usage: clear() once -> insert() new objects, move() the ones needsMove() reports -> query().
+class HierarchicalGrid {
+private:
+    std::vector<SpatialGrid> m_levels;
+    std::vector<uint32_t> m_levelCount; // objects inserted per level since the last clear()
+    float m_minCellSize;
+    bool m_incremental = false;
+    float m_hysteresis = 0.f; // fraction of the cell size
+
+    bool m_dense = false;
+    float m_min[3] = { 0.f, 0.f, 0.f };
+    float m_max[3] = { 0.f, 0.f, 0.f };
+
+    void addLevel() {
+        float cellSize = m_minCellSize * (float)(1u << m_levels.size());
+        m_levels.emplace_back(cellSize);
+        m_levelCount.push_back(0);
+        if (m_dense) {
+            m_levels.back().setDenseBounds(m_min[0], m_min[1], m_min[2], m_max[0], m_max[1], m_max[2]);
+            m_levels.back().setLinked(m_incremental);
+        }
+    }
+
+public:
+    // Extents beyond the cell size of the last level are put there anyway and can miss pairs
+    static constexpr uint32_t MAX_LEVELS = 12;
+
+    HierarchicalGrid(float minCellSize) : m_minCellSize(minCellSize) {}
+
+    // Switches every level to dense mode over the box [min, max]
+    void setDenseBounds(float minX, float minY, float minZ, float maxX, float maxY, float maxZ) {
+        m_dense = true;
+        m_min[0] = minX; m_min[1] = minY; m_min[2] = minZ;
+        m_max[0] = maxX; m_max[1] = maxY; m_max[2] = maxZ;
+        for (uint32_t level = 0; level < m_levels.size(); ++level) {
+            m_levels[level].setDenseBounds(minX, minY, minZ, maxX, maxY, maxZ);
+            m_levels[level].setLinked(m_incremental);
+            m_levelCount[level] = 0;
+        }
+    }
+
+    // Needs dense bounds, switching modes empties the grid
+    void setIncremental(bool incremental, float hysteresis = 0.f) {
+        m_incremental = incremental && m_dense;
+        m_hysteresis = m_incremental ? hysteresis : 0.f;
+        for (uint32_t level = 0; level < m_levels.size(); ++level) {
+            m_levels[level].setLinked(m_incremental);
+            m_levelCount[level] = 0;
+        }
+    }
+
+    inline bool isIncremental() const { return m_incremental; }
+
+    uint32_t levelOf(float extent) const {
+        uint32_t level = 0;
+        float cellSize = m_minCellSize;
+        while (cellSize < extent && level + 1 < MAX_LEVELS) {
+            cellSize *= 2.f;
+            ++level;
+        }
+        return level;
+    }
+
+    inline uint32_t getLevelCount() const { return (uint32_t)m_levels.size(); }
+    inline float getCellSize(uint32_t level) const { return m_minCellSize * (float)(1u << level); }
+    inline uint32_t getObjectCount(uint32_t level) const { return level < m_levelCount.size() ? m_levelCount[level] : 0; }
+
+    // Highest level with objects this frame plus one, 0 when the grid is empty
+    uint32_t getUsedLevels() const {
+        uint32_t used = (uint32_t)m_levelCount.size();
+        while (used > 0 && m_levelCount[used - 1] == 0) --used;
+        return used;
+    }
+
+    void clear() {
+        for (uint32_t level = 0; level < m_levels.size(); ++level) {
+            if (m_levelCount[level] == 0) continue;
+            m_levels[level].clear();
+            m_levelCount[level] = 0;
+        }
+    }
+
+    // Returns the level the object went into
+    uint32_t insert(uint32_t objectIndex, float x, float y, float z, float extent) {
+        uint32_t level = levelOf(extent);
+        while (m_levels.size() <= level) addLevel();
+        m_levels[level].insert(objectIndex, x, y, z);
+        ++m_levelCount[level];
+        return level;
+    }
+
+    // Incremental mode: true once the object is further than its hysteresis margin from its cell
+    bool needsMove(uint32_t objectIndex, uint32_t level, float x, float y, float z, float extent) const {
+        float cellSize = getCellSize(level);
+        float room = (cellSize - extent) * .5f;
+        float margin = m_hysteresis * cellSize;
+        margin = margin < room ? margin : room;
+        return m_levels[level].needsMove(objectIndex, x, y, z, margin > 0.f ? margin : 0.f);
+    }
+
+    void move(uint32_t objectIndex, uint32_t level, float x, float y, float z) {
+        m_levels[level].move(objectIndex, x, y, z);
+    }
+
+    void build() {
+        for (uint32_t level = 0; level < m_levels.size(); ++level) {
+            if (m_levelCount[level] > 0) m_levels[level].build();
+        }
+    }
+
+    // Objects around (x, y, z) on firstLevel and every coarser level. The first sameLevelCount
+    // results are the ones on firstLevel.
+    void query(float x, float y, float z, uint32_t firstLevel, std::vector<uint32_t>& results, uint32_t& sameLevelCount) const {
+        results.clear();
+        sameLevelCount = 0;
+        for (uint32_t level = firstLevel; level < m_levels.size(); ++level) {
+            if (m_levelCount[level] > 0) {
+                m_levels[level].appendNeighbors(x, y, z, results);
+            }
+            if (level == firstLevel) sameLevelCount = (uint32_t)results.size();
+        }
+    }
+};
@@ -156,6 +156,24 @@ int InputController::parseInputs(GLFWwindow* window, float deltaTime) {
 		muteChecker = true;
 	}
 
+	//switch broadphase
+	if ((glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) && broadphaseChecker) {
+		broadphaseChecker = false;
+		shapeArray->CycleBroadphase();
+	}
+	else if (glfwGetKey(window, GLFW_KEY_B) == GLFW_RELEASE) {
+		broadphaseChecker = true;
+	}
+
+	//toggle continuous collision
+	if ((glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) && ccdChecker) {
+		ccdChecker = false;
+		shapeArray->ToggleContinuousCollision();
+	}
+	else if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE) {
+		ccdChecker = true;
+	}
+
 	camera->updateView();
 
 	return glfwGetKey(window, GLFW_KEY_ESCAPE);
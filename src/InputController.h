@@ -20,6 +20,8 @@ private:
 	bool spaceChecker = true;
 	bool texChecker = true;
 	bool muteChecker = true;
+	bool broadphaseChecker = true;
+	bool ccdChecker = true;
 
 public:
 	InputController(CameraController* camera, DynamicShapeArray* shapeArray);
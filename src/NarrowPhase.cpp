@@ -0,0 +1,358 @@
+#include "NarrowPhase.h"
+#include <utility>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define NARROWPHASE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define NARROWPHASE_SSE2
+#endif
+
+namespace NarrowPhase {
+namespace {
+
+	/* Lane types
+	- F holds one float per pair, M one comparison result per pair
+	- the Not* comparisons are true for NaN, so !(a < b) in the scalar code maps to NotLess(a, b)
+	*/
+	struct ScalarF { float v; };
+	struct ScalarM { bool v; };
+	inline ScalarF operator+(ScalarF a, ScalarF b) { return { a.v + b.v }; }
+	inline ScalarF operator-(ScalarF a, ScalarF b) { return { a.v - b.v }; }
+	inline ScalarF operator*(ScalarF a, ScalarF b) { return { a.v * b.v }; }
+	inline ScalarM operator&(ScalarM a, ScalarM b) { return { a.v && b.v }; }
+	inline ScalarM operator|(ScalarM a, ScalarM b) { return { a.v || b.v }; }
+
+	struct ScalarLanes {
+		using F = ScalarF;
+		using M = ScalarM;
+		static constexpr uint32_t WIDTH = 1;
+
+		static inline F Set(float value) { return { value }; }
+		static inline F Gather(const float* base, const uint32_t* index) { return { base[index[0]] }; }
+		static inline F Load(const float* source) { return { source[0] }; }
+		static inline void Store(float* target, F a) { target[0] = a.v; }
+		static inline F Min(F a, F b) { return { b.v < a.v ? b.v : a.v }; }
+		static inline F Max(F a, F b) { return { a.v < b.v ? b.v : a.v }; }
+		static inline F Select(M mask, F a, F b) { return { mask.v ? a.v : b.v }; }
+		static inline F Abs(F a) { return { a.v < 0 ? -a.v : a.v }; }
+		static inline M Less(F a, F b) { return { a.v < b.v }; }
+		static inline M LessEqual(F a, F b) { return { a.v <= b.v }; }
+		static inline M GreaterEqual(F a, F b) { return { a.v >= b.v }; }
+		static inline M NotLess(F a, F b) { return { !(a.v < b.v) }; }
+		static inline M NotGreater(F a, F b) { return { !(a.v > b.v) }; }
+		static inline M NotGreaterEqual(F a, F b) { return { !(a.v >= b.v) }; }
+		static inline M Not(M a) { return { !a.v }; }
+		static inline uint32_t Bits(M a) { return a.v ? 1u : 0u; }
+	};
+
+#if defined(NARROWPHASE_SSE2)
+	struct SseF { __m128 v; };
+	struct SseM { __m128 v; };
+	inline SseF operator+(SseF a, SseF b) { return { _mm_add_ps(a.v, b.v) }; }
+	inline SseF operator-(SseF a, SseF b) { return { _mm_sub_ps(a.v, b.v) }; }
+	inline SseF operator*(SseF a, SseF b) { return { _mm_mul_ps(a.v, b.v) }; }
+	inline SseM operator&(SseM a, SseM b) { return { _mm_and_ps(a.v, b.v) }; }
+	inline SseM operator|(SseM a, SseM b) { return { _mm_or_ps(a.v, b.v) }; }
+
+	struct SseLanes {
+		using F = SseF;
+		using M = SseM;
+		static constexpr uint32_t WIDTH = 4;
+
+		static inline F Set(float value) { return { _mm_set1_ps(value) }; }
+		static inline F Gather(const float* base, const uint32_t* index) {
+			return { _mm_setr_ps(base[index[0]], base[index[1]], base[index[2]], base[index[3]]) };
+		}
+		static inline F Load(const float* source) { return { _mm_loadu_ps(source) }; }
+		static inline void Store(float* target, F a) { _mm_storeu_ps(target, a.v); }
+		static inline F Min(F a, F b) { return { _mm_min_ps(a.v, b.v) }; }
+		static inline F Max(F a, F b) { return { _mm_max_ps(a.v, b.v) }; }
+		static inline F Select(M mask, F a, F b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+		static inline F Abs(F a) { return { _mm_andnot_ps(_mm_set1_ps(-0.f), a.v) }; }
+		static inline M Less(F a, F b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+		static inline M LessEqual(F a, F b) { return { _mm_cmple_ps(a.v, b.v) }; }
+		static inline M GreaterEqual(F a, F b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+		static inline M NotLess(F a, F b) { return { _mm_cmpnlt_ps(a.v, b.v) }; }
+		static inline M NotGreater(F a, F b) { return { _mm_cmpngt_ps(a.v, b.v) }; }
+		static inline M NotGreaterEqual(F a, F b) { return { _mm_cmpnge_ps(a.v, b.v) }; }
+		static inline M Not(M a) { return { _mm_xor_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(-1))) }; }
+		static inline uint32_t Bits(M a) { return static_cast<uint32_t>(_mm_movemask_ps(a.v)); }
+	};
+	using NativeLanes = SseLanes;
+#elif defined(NARROWPHASE_AVX2)
+	struct AvxF { __m256 v; };
+	struct AvxM { __m256 v; };
+	inline AvxF operator+(AvxF a, AvxF b) { return { _mm256_add_ps(a.v, b.v) }; }
+	inline AvxF operator-(AvxF a, AvxF b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	inline AvxF operator*(AvxF a, AvxF b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	inline AvxM operator&(AvxM a, AvxM b) { return { _mm256_and_ps(a.v, b.v) }; }
+	inline AvxM operator|(AvxM a, AvxM b) { return { _mm256_or_ps(a.v, b.v) }; }
+
+	struct AvxLanes {
+		using F = AvxF;
+		using M = AvxM;
+		static constexpr uint32_t WIDTH = 8;
+
+		static inline F Set(float value) { return { _mm256_set1_ps(value) }; }
+		static inline F Gather(const float* base, const uint32_t* index) {
+			__m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index));
+			return { _mm256_i32gather_ps(base, offsets, 4) };
+		}
+		static inline F Load(const float* source) { return { _mm256_loadu_ps(source) }; }
+		static inline void Store(float* target, F a) { _mm256_storeu_ps(target, a.v); }
+		static inline F Min(F a, F b) { return { _mm256_min_ps(a.v, b.v) }; }
+		static inline F Max(F a, F b) { return { _mm256_max_ps(a.v, b.v) }; }
+		static inline F Select(M mask, F a, F b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+		static inline F Abs(F a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v) }; }
+		static inline M Less(F a, F b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+		static inline M LessEqual(F a, F b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+		static inline M GreaterEqual(F a, F b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+		static inline M NotLess(F a, F b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_NLT_UQ) }; }
+		static inline M NotGreater(F a, F b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_NGT_UQ) }; }
+		static inline M NotGreaterEqual(F a, F b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_NGE_UQ) }; }
+		static inline M Not(M a) { return { _mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; }
+		static inline uint32_t Bits(M a) { return static_cast<uint32_t>(_mm256_movemask_ps(a.v)); }
+	};
+	using NativeLanes = AvxLanes;
+#else
+	using NativeLanes = ScalarLanes;
+#endif
+
+	/* Pair tests
+	- I is the first body and J the second, in the canonical order of PAIR_TABLE
+	- every test starts with the overlap of the predicted boxes, then the shape specific part.
+	  The shapes are approximated by their extent d: spheres and cylinders by a radius of d / 2,
+	  rings by their outer size.
+	*/
+	template<typename L, PairKind KIND>
+	inline typename L::M TestLanes(const BodyView& bodies, const uint32_t* first, const uint32_t* second) {
+		using F = typename L::F;
+		using M = typename L::M;
+
+		if constexpr (KIND == PAIR_RING_CYLINDER || KIND == PAIR_RING_RING) {
+			const F zero = L::Set(0.f);
+			return L::Less(zero, zero);
+		}
+
+		const F iX = L::Gather(bodies.posX, first) + L::Gather(bodies.velX, first);
+		const F iY = L::Gather(bodies.posY, first) + L::Gather(bodies.velY, first);
+		const F iZ = L::Gather(bodies.posZ, first) + L::Gather(bodies.velZ, first);
+		const F jX = L::Gather(bodies.posX, second) + L::Gather(bodies.velX, second);
+		const F jY = L::Gather(bodies.posY, second) + L::Gather(bodies.velY, second);
+		const F jZ = L::Gather(bodies.posZ, second) + L::Gather(bodies.velZ, second);
+		const F size0 = L::Gather(bodies.d, first);
+		const F size1 = L::Gather(bodies.d, second);
+
+		const F half = L::Set(.5f);
+		const F size1div2 = size1 * half;
+		const F size0div2 = size0 * half;
+		const F size1p0div2 = size1div2 + size0div2;
+		const F size10div2 = L::Abs(size1 - size0) * half;
+
+		// AABB early test
+		M hit = L::NotLess(iX + size0div2, jX - size1div2) & L::NotLess(jX + size1div2, iX - size0div2);
+		hit = hit & L::NotLess(iY + size0div2, jY - size1div2) & L::NotLess(jY + size1div2, iY - size0div2);
+		hit = hit & L::NotLess(iZ + size0div2, jZ - size1div2) & L::NotLess(jZ + size1div2, iZ - size0div2);
+
+		const F dx = L::Abs(iX - jX);
+		const F dy = L::Abs(iY - jY);
+		const F dz = L::Abs(iZ - jZ);
+
+		if constexpr (KIND == PAIR_SPHERE_SPHERE) {
+			F dsqr = dx * dx + dy * dy + dz * dz;
+			return hit & L::LessEqual(dsqr, size1p0div2 * size1p0div2) & L::GreaterEqual(dsqr, size1 * size1 * L::Set(.25f));
+		}
+		else if constexpr (KIND == PAIR_CUBE_CUBE) {
+			M touching = L::LessEqual(dx, size1p0div2) & L::LessEqual(dy, size1p0div2) & L::LessEqual(dz, size1p0div2);
+			M notInside = L::GreaterEqual(dx, size10div2) | L::GreaterEqual(dy, size10div2) | L::GreaterEqual(dz, size10div2);
+			return hit & touching & notInside;
+		}
+		else if constexpr (KIND == PAIR_SPHERE_CYLINDER) {
+			// the cylinder's side first, then its rim as a sphere of radius sqrt(2) * d / 2
+			M near = L::NotGreater(dx, size1p0div2) & L::NotGreater(dy, size1p0div2) & L::NotGreater(dz, size1p0div2);
+			F dsqr = dx * dx + dz * dz;
+			M side = L::LessEqual(dsqr, size1p0div2 * size1p0div2) & L::LessEqual(dy, size1div2);
+			dsqr = dx * dx + dy * dy + dz * dz;
+			F rim = size0div2 + L::Set(SQRT_2) * size1div2;
+			return hit & near & (side | L::LessEqual(dsqr, rim * rim));
+		}
+		else if constexpr (KIND == PAIR_CYLINDER_CYLINDER) {
+			F dsqr = dx * dx + dz * dz;
+			M near = L::NotGreater(dsqr, size1p0div2 * size1p0div2) & L::NotGreaterEqual(dy, size1p0div2);
+			dsqr = dx * dx + dy * dy + dz * dz;
+			const F root2 = L::Set(SQRT_2);
+			M rim = L::LessEqual(dsqr, (root2 * size0div2 + root2 * size1div2) * (root2 * size0 + root2 * size1div2));
+			return hit & near & (L::Less(dy, size1div2) | rim);
+		}
+		else if constexpr (KIND == PAIR_RING_CUBE) {
+			// every branch after the inside test is a hit
+			M near = L::NotGreaterEqual(dx, size1p0div2) & L::NotGreaterEqual(dy, size1p0div2) & L::NotGreaterEqual(dz, size1p0div2);
+			M inside = L::Less(dx, size10div2) & L::Less(dy, size10div2) & L::Less(dz, size10div2);
+			return hit & near & L::Not(inside);
+		}
+		else if constexpr (KIND == PAIR_RING_SPHERE) {
+			F reach = size1div2 + size0;
+			M near = L::NotGreater(dx, reach) & L::NotGreater(dy, reach) & L::NotGreater(dz, reach);
+			F dsqr = dx * dx + dz * dz;
+			M side = L::LessEqual(dsqr, (size0 + size1div2) * (size1div2 + size0)) & L::LessEqual(dy, size1div2);
+			dsqr = dx * dx + dy * dy + dz * dz;
+			F rim = size0div2 + L::Set(SQRT_2) * size1div2;
+			return hit & near & (side | L::LessEqual(dsqr, rim * rim));
+		}
+		else {
+			// sphere-cube and cylinder-cube share the branch chain, only the corner radius differs
+			M near = L::NotGreaterEqual(dx, size1p0div2) & L::NotGreaterEqual(dy, size1p0div2) & L::NotGreaterEqual(dz, size1p0div2);
+			M inside = L::Less(dx, size10div2) & L::Less(dy, size10div2) & L::Less(dz, size10div2);
+			M face = L::Less(dx, size1div2) | L::Less(dy, size1div2) | L::Less(dz, size1div2);
+			F cornerDistance_sq = ((dx - size1div2) * (dx - size1div2)) +
+				((dy - size1div2) * (dy - size1div2)) +
+				((dz - size1div2) * (dz - size1div2));
+			F cornerRadius_sq = KIND == PAIR_SPHERE_CUBE ? size0div2 * size0div2 : size0 * size0div2;
+			M corner = L::Less(cornerDistance_sq, cornerRadius_sq);
+			return hit & near & L::Not(inside) & (face | corner);
+		}
+	}
+
+	/* Wall kernel
+	- one axis at a time: the speed flips when the predicted position reaches past a wall and the
+	  body moves towards it, then the position is clamped to the inside of the box
+	- a body larger than the box ends up against its min walls
+	- the returned lanes changed speed or position, both move the body by more than its speed
+	  predicts, which the pair cache has to hear about
+	*/
+	template<typename L>
+	inline typename L::M WallAxis(const WorldBox& box, int axis, typename L::F half, typename L::F& pos, typename L::F& vel) {
+		using F = typename L::F;
+		using M = typename L::M;
+		const F zero = L::Set(0.f);
+		const F lo = L::Set(box.min[axis]) + half;
+		const F hi = L::Set(box.max[axis]) - half;
+		const F predicted = pos + vel;
+		M bounce = (L::LessEqual(predicted, lo) & L::Less(vel, zero)) | (L::GreaterEqual(predicted, hi) & L::Less(zero, vel));
+		vel = L::Select(bounce, zero - vel, vel);
+		const F clamped = L::Max(L::Min(pos, hi), lo);
+		bounce = bounce | L::Less(clamped, pos) | L::Less(pos, clamped);
+		pos = clamped;
+		return bounce;
+	}
+
+	// WIDTH bodies starting at index, or at body first when index is null
+	template<typename L>
+	inline uint32_t WallLanes(const WorldBox& box, const BodyState& bodies, const uint32_t* index, uint32_t first) {
+		using F = typename L::F;
+		using M = typename L::M;
+		const F half = (index ? L::Gather(bodies.d, index) : L::Load(bodies.d + first)) * L::Set(.5f);
+		M bounce = L::Less(half, half);
+		for (int axis = 0; axis < 3; ++axis) {
+			F pos = index ? L::Gather(bodies.pos[axis], index) : L::Load(bodies.pos[axis] + first);
+			F vel = index ? L::Gather(bodies.vel[axis], index) : L::Load(bodies.vel[axis] + first);
+			bounce = bounce | WallAxis<L>(box, axis, half, pos, vel);
+			if (index) {
+				float lanes[2][L::WIDTH];
+				L::Store(lanes[0], pos);
+				L::Store(lanes[1], vel);
+				for (uint32_t lane = 0; lane < L::WIDTH; ++lane) {
+					bodies.pos[axis][index[lane]] = lanes[0][lane];
+					bodies.vel[axis][index[lane]] = lanes[1][lane];
+				}
+			}
+			else {
+				L::Store(bodies.pos[axis] + first, pos);
+				L::Store(bodies.vel[axis] + first, vel);
+			}
+		}
+		return L::Bits(bounce);
+	}
+
+	template<typename L>
+	void RunWallKernel(const WorldBox& box, const BodyState& bodies, const uint32_t* indices, uint32_t begin, uint32_t count, uint8_t* reflected) {
+		uint32_t padIndex[L::WIDTH];
+		for (uint32_t k = 0; k < count; k += L::WIDTH) {
+			const uint32_t valid = count - k < L::WIDTH ? count - k : L::WIDTH;
+			const uint32_t* index = indices ? indices + k : nullptr;
+			if (valid < L::WIDTH) {
+				// the tail repeats its last body, the duplicates store the same values again
+				for (uint32_t lane = 0; lane < L::WIDTH; ++lane) {
+					uint32_t source = lane < valid ? lane : valid - 1;
+					padIndex[lane] = indices ? indices[k + source] : begin + k + source;
+				}
+				index = padIndex;
+			}
+			uint32_t bits = WallLanes<L>(box, bodies, index, begin + k);
+			for (uint32_t lane = 0; lane < valid; ++lane) {
+				reflected[k + lane] = (bits >> lane) & 1u;
+			}
+		}
+	}
+
+	template<typename L, PairKind KIND>
+	void RunKernel(const BodyView& bodies, PairBatch& batch) {
+		const uint32_t count = batch.size();
+		batch.hitMask.assign((count + 31) / 32, 0u);
+
+		uint32_t padFirst[L::WIDTH], padSecond[L::WIDTH];
+		for (uint32_t k = 0; k < count; k += L::WIDTH) {
+			const uint32_t* first = batch.first.data() + k;
+			const uint32_t* second = batch.second.data() + k;
+			const uint32_t valid = count - k < L::WIDTH ? count - k : L::WIDTH;
+			if (valid < L::WIDTH) {
+				// the tail repeats its last pair in the unused lanes, their bits are dropped below
+				for (uint32_t lane = 0; lane < L::WIDTH; ++lane) {
+					uint32_t source = lane < valid ? lane : valid - 1;
+					padFirst[lane] = first[source];
+					padSecond[lane] = second[source];
+				}
+				first = padFirst;
+				second = padSecond;
+			}
+			uint32_t bits = L::Bits(TestLanes<L, KIND>(bodies, first, second)) & ((1u << valid) - 1u);
+			// WIDTH divides 32, so a block never straddles two mask words
+			batch.hitMask[k >> 5] |= bits << (k & 31);
+		}
+	}
+
+	template<PairKind KIND>
+	bool TestSingle(const BodyView& bodies, uint32_t first, uint32_t second) {
+		return ScalarLanes::Bits(TestLanes<ScalarLanes, KIND>(bodies, &first, &second)) != 0;
+	}
+
+	// One instance per pair kind, indexed by PairKind
+	using BatchKernel = void (*)(const BodyView&, PairBatch&);
+	using PairTest = bool (*)(const BodyView&, uint32_t, uint32_t);
+
+	template<size_t... KIND>
+	constexpr std::array<BatchKernel, PAIR_KIND_COUNT> MakeBatchKernels(std::index_sequence<KIND...>) {
+		return { &RunKernel<NativeLanes, static_cast<PairKind>(KIND)>... };
+	}
+
+	template<size_t... KIND>
+	constexpr std::array<PairTest, PAIR_KIND_COUNT> MakePairTests(std::index_sequence<KIND...>) {
+		return { &TestSingle<static_cast<PairKind>(KIND)>... };
+	}
+
+	constexpr std::array<BatchKernel, PAIR_KIND_COUNT> BATCH_KERNELS = MakeBatchKernels(std::make_index_sequence<PAIR_KIND_COUNT>{});
+	constexpr std::array<PairTest, PAIR_KIND_COUNT> PAIR_TESTS = MakePairTests(std::make_index_sequence<PAIR_KIND_COUNT>{});
+}
+
+	void TestBatch(PairKind kind, const BodyView& bodies, PairBatch& batch) {
+		BATCH_KERNELS[kind](bodies, batch);
+	}
+
+	bool TestPair(PairKind kind, const BodyView& bodies, uint32_t first, uint32_t second) {
+		return PAIR_TESTS[kind](bodies, first, second);
+	}
+
+	void ResolveWalls(const WorldBox& box, const BodyState& bodies, const uint32_t* indices, uint32_t count, uint8_t* reflected) {
+		RunWallKernel<NativeLanes>(box, bodies, indices, 0, count, reflected);
+	}
+
+	void ResolveWalls(const WorldBox& box, const BodyState& bodies, uint32_t begin, uint32_t end, uint8_t* reflected) {
+		RunWallKernel<NativeLanes>(box, bodies, nullptr, begin, end - begin, reflected);
+	}
+
+	uint32_t GetLaneCount() {
+		return NativeLanes::WIDTH;
+	}
+}
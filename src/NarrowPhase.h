@@ -0,0 +1,136 @@
+#pragma once
+#include "Shape.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/*
+Batched narrowphase
+- candidate pairs are bucketed by shape type combination, so a whole batch runs the same test
+  without any per pair branching
+- one templated test per pair kind, written once against a small lane type and compiled for
+  AVX2 (8 lanes), SSE2 (4 lanes) or plain scalar code, whichever the target supports. Every
+  branch chain of the original narrowphase is turned into the equivalent mask expression.
+- the shape types of a pair pick kind and operand order from PAIR_TABLE, built at compile time,
+  and the kind picks its kernel from a table of template instances, so there is no type switch
+  left at run time. Single pairs (TestPair) run the scalar instance of the same kernel.
+- the enclosure walls don't go through pairs at all: a separate kernel streams over the bodies
+  and bounces them off the six planes of the world box
+*/
+namespace NarrowPhase {
+
+	// Shape type pairs in canonical (I, J) order
+	enum PairKind {
+		PAIR_SPHERE_SPHERE = 0,
+		PAIR_CUBE_CUBE,
+		PAIR_SPHERE_CUBE,
+		PAIR_CYLINDER_CUBE,
+		PAIR_SPHERE_CYLINDER,
+		PAIR_CYLINDER_CYLINDER,
+		PAIR_RING_CUBE,
+		PAIR_RING_SPHERE,
+		PAIR_RING_CYLINDER, // never collide
+		PAIR_RING_RING,     // never collide
+		PAIR_KIND_COUNT
+	};
+
+	// Read-only view of the body arrays the kernels need
+	struct BodyView {
+		const float* posX;
+		const float* posY;
+		const float* posZ;
+		const float* velX;
+		const float* velY;
+		const float* velZ;
+		const float* d;
+	};
+
+	// Inside of the world box every movable body is kept in
+	struct WorldBox {
+		float min[3];
+		float max[3];
+	};
+
+	// Body arrays the wall stage reads and writes, pos and vel by axis
+	struct BodyState {
+		float* pos[3];
+		float* vel[3];
+		const float* d;
+	};
+
+	// Candidate pairs of a single kind, stored in canonical (I, J) order
+	struct PairBatch {
+		std::vector<uint32_t> first;
+		std::vector<uint32_t> second;
+		std::vector<uint32_t> hitMask; // bit k % 32 of word k / 32 is set when pair k collides
+
+		inline uint32_t size() const { return static_cast<uint32_t>(first.size()); }
+		inline void push(uint32_t i, uint32_t j) { first.push_back(i); second.push_back(j); }
+		inline void clear() { first.clear(); second.clear(); }
+	};
+
+	struct PairEntry {
+		PairKind kind;
+		bool swap; // the second body of the pair goes to I
+	};
+
+	// Canonical ordering:
+	// - Ring always goes to I
+	// - Sphere always goes to I unless paired with Ring
+	// - Cylinder goes to I only if paired with Cube
+	constexpr PairEntry MakePairEntry(int typeI, int typeJ) {
+		bool swap = ((typeJ == T_RING || typeJ == T_SPHERE) && typeI != T_RING) ||
+			(typeI == T_CUBE && typeJ == T_CYLINDER);
+		if (swap) {
+			int type = typeI;
+			typeI = typeJ;
+			typeJ = type;
+		}
+		PairKind kind = PAIR_RING_RING;
+		if (typeI == T_SPHERE) kind = typeJ == T_SPHERE ? PAIR_SPHERE_SPHERE : typeJ == T_CUBE ? PAIR_SPHERE_CUBE : PAIR_SPHERE_CYLINDER;
+		else if (typeI == T_CUBE) kind = PAIR_CUBE_CUBE;
+		else if (typeI == T_CYLINDER) kind = typeJ == T_CUBE ? PAIR_CYLINDER_CUBE : PAIR_CYLINDER_CYLINDER;
+		else if (typeJ == T_CUBE) kind = PAIR_RING_CUBE;
+		else if (typeJ == T_SPHERE) kind = PAIR_RING_SPHERE;
+		else if (typeJ == T_CYLINDER) kind = PAIR_RING_CYLINDER;
+		return { kind, swap };
+	}
+
+	constexpr std::array<std::array<PairEntry, SHAPE_TYPE_COUNT>, SHAPE_TYPE_COUNT> MakePairTable() {
+		std::array<std::array<PairEntry, SHAPE_TYPE_COUNT>, SHAPE_TYPE_COUNT> table{};
+		for (int typeI = 0; typeI < SHAPE_TYPE_COUNT; ++typeI) {
+			for (int typeJ = 0; typeJ < SHAPE_TYPE_COUNT; ++typeJ) {
+				table[typeI][typeJ] = MakePairEntry(typeI, typeJ);
+			}
+		}
+		return table;
+	}
+
+	// Kind and operand order by shape type of the first and second body
+	inline constexpr auto PAIR_TABLE = MakePairTable();
+	static_assert(PAIR_TABLE[T_CUBE][T_SPHERE].kind == PAIR_SPHERE_CUBE && PAIR_TABLE[T_CUBE][T_SPHERE].swap);
+	static_assert(PAIR_TABLE[T_CYLINDER][T_RING].kind == PAIR_RING_CYLINDER && PAIR_TABLE[T_CYLINDER][T_RING].swap);
+
+	inline PairKind Classify(int typeI, int typeJ, bool& swap) {
+		const PairEntry& entry = PAIR_TABLE[typeI][typeJ];
+		swap = entry.swap;
+		return entry.kind;
+	}
+
+	// Tests every pair of the batch and fills batch.hitMask
+	void TestBatch(PairKind kind, const BodyView& bodies, PairBatch& batch);
+
+	// Tests a single pair, first and second already in canonical order for kind
+	bool TestPair(PairKind kind, const BodyView& bodies, uint32_t first, uint32_t second);
+
+	// Wall stage for the bodies indices[0, count): bodies whose predicted box reaches past a wall of
+	// the box while moving towards it have that speed component flipped, and every position is
+	// clamped to the inside. reflected[k] is set to 1 when the speed or the position of body
+	// indices[k] changed.
+	void ResolveWalls(const WorldBox& box, const BodyState& bodies, const uint32_t* indices, uint32_t count, uint8_t* reflected);
+	// Same for the body range [begin, end), reflected[k] belongs to body begin + k
+	void ResolveWalls(const WorldBox& box, const BodyState& bodies, uint32_t begin, uint32_t end, uint8_t* reflected);
+
+	// Lanes per kernel invocation on this build (8 for AVX2, 4 for SSE2, 1 otherwise)
+	uint32_t GetLaneCount();
+}
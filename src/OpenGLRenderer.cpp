@@ -4,6 +4,8 @@
 #include "stb_image.h"
 #include "PathUtils.h"
 #include <filesystem>
+#include <algorithm>
+#include <cmath>
 
 #ifdef _DEBUG
 void APIENTRY glDebugOutput(GLenum source,
@@ -23,6 +25,9 @@ OpenGLRenderer::~OpenGLRenderer() {
 	for (uint32_t tex : textures) {
 		glDeleteTextures(1, &tex);
 	}
+	for (GLsync& fence : frameFences) {
+		if (fence) glDeleteSync(fence);
+	}
 	for (std::pair<uint32_t, uint32_t> handle: typeToSSBOMap) {
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, handle.second);
 		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
@@ -32,12 +37,9 @@ OpenGLRenderer::~OpenGLRenderer() {
 	for (std::pair<uint32_t, uint32_t> handle : typeToUBOMap) {
 		glDeleteBuffers(1, &handle.second);
 	}
-	for (std::pair<uint32_t, uint32_t> handle : shapeVBOIDmap) {
-		glDeleteBuffers(1, &handle.second);
-	}
-	for (std::pair<uint32_t, uint32_t> handle : shapeVAOIDmap) {
-		glDeleteVertexArrays(1, &handle.second);
-	}
+	GLuint meshBuffers[] = { meshPositionVBO, meshNormalVBO, meshIBO };
+	glDeleteBuffers(3, meshBuffers);
+	glDeleteVertexArrays(1, &meshVAO);
 
 	if (window) glfwDestroyWindow(window);
 	glfwTerminate();
@@ -135,14 +137,13 @@ void OpenGLRenderer::init(uint16_t windowWidth, uint16_t windowHeight) {
 	glDepthFunc(GL_LESS);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssboOffsetAlignment);
 
 }
 void OpenGLRenderer::BindShape(int shapeType) {
-	if (shapeVAOIDmap.find(shapeType) != shapeVAOIDmap.end()) {
-		glBindVertexArray(shapeVAOIDmap[shapeType]);
-	}
-	if (shapeIBOIDmap.find(shapeType) != shapeIBOIDmap.end()) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shapeIBOIDmap[shapeType]);
+	if (shapeMeshMap.find(shapeType) != shapeMeshMap.end()) {
+		glBindVertexArray(meshVAO);
+		boundShapeType = shapeType;
 	}
 }
 void OpenGLRenderer::createUBO(uint32_t binding, uint16_t type, uint32_t size) {
@@ -157,55 +158,72 @@ void OpenGLRenderer::createUBO(uint32_t binding, uint16_t type, uint32_t size) {
 	typeToUBOSize[type] = size;
 }
 
-void OpenGLRenderer::createSSBO(uint32_t binding, uint16_t type, uint32_t size) {
+uint64_t OpenGLRenderer::alignRegionSize(uint64_t size) const {
+	// every region starts at a valid glBindBufferRange offset, and is never empty
+	uint64_t alignment = static_cast<uint64_t>(ssboOffsetAlignment);
+	return std::max<uint64_t>(1, (size + alignment - 1) / alignment) * alignment;
+}
+
+void OpenGLRenderer::createPersistentBuffer(uint16_t type, uint64_t size) {
+	uint64_t regionSize = alignRegionSize(size);
+	uint64_t bufferSize = regionSize * SSBO_FRAME_COUNT;
 	GLuint ssbo;
 	glGenBuffers(1, &ssbo);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
 	// We don't need to use glBufferSubData, so dynamic bit is off. Important for performance.
 	// I'll just use mapping.
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, NULL, ssboUsageFlags); // TODO: parameterize usage flags
-	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, ssbo, 0, size);
-	void* ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, ssboUsageFlags);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, bufferSize, NULL, ssboUsageFlags); // TODO: parameterize usage flags
+	void* ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bufferSize, ssboUsageFlags);
 	typeToSSBOMap[type] = ssbo;
-	typeToSSBOSize[type] = size;
+	typeToSSBOSize[type] = regionSize;
 	for (uint16_t i = 1; ptr == nullptr ; ++i) {
 		if (0 == i) throw std::runtime_error("GPU data upload failed. glMapBufferRange returned null pointer.");
-		ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, typeToSSBOSize[type], ssboUsageFlags | GL_MAP_INVALIDATE_BUFFER_BIT);
+		ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bufferSize, ssboUsageFlags | GL_MAP_INVALIDATE_BUFFER_BIT);
 	}
-	PersistentBuffer persistentBuffer{ssbo, ptr, size};
+	PersistentBuffer persistentBuffer{ssbo, ptr, bufferSize, regionSize};
 	typeToPersistentSSBOMap[type] = persistentBuffer;
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
-void OpenGLRenderer::resizeSSBO(uint16_t type, uint32_t newSize) {
+void OpenGLRenderer::createSSBO(uint32_t binding, uint16_t type, uint32_t size) {
+	createPersistentBuffer(type, size);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, typeToSSBOMap[type], ssboFrameIndex * typeToSSBOSize[type], typeToSSBOSize[type]);
+}
+
+void OpenGLRenderer::createIndirectBuffer(uint16_t type, uint32_t size) {
+	// same storage as the SSBOs, only bound to GL_DRAW_INDIRECT_BUFFER when drawing
+	createPersistentBuffer(type, size);
+}
+
+void OpenGLRenderer::resizeSSBO(uint16_t type, uint64_t newSize) {
+	// Nothing is copied: the regions of the other frames are stale and the current one is rewritten
+	// by the caller. The old buffer may still be read by frames in flight, GL keeps it alive until they finish.
+	uint64_t regionSize = alignRegionSize(newSize);
+	uint64_t bufferSize = regionSize * SSBO_FRAME_COUNT;
 	GLuint ssbo;
 	glGenBuffers(1, &ssbo);
-	glBindBuffer(GL_COPY_WRITE_BUFFER, ssbo);
-	glBufferStorage(GL_COPY_WRITE_BUFFER, newSize, NULL, ssboUsageFlags);
-	glBindBuffer(GL_COPY_READ_BUFFER, typeToSSBOMap[type]);
-	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, std::min(newSize, typeToSSBOSize[type]));
-	glBindBuffer(GL_COPY_WRITE_BUFFER, 0); // should be correct, but it generates error 1280
-	glBindBuffer(GL_COPY_READ_BUFFER, 0);
-	typeToSSBOSize[type] = newSize;
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, typeToSSBOMap[type]);
 	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 	glDeleteBuffers(1, &typeToSSBOMap[type]);
 	typeToSSBOMap[type] = ssbo;
+	typeToSSBOSize[type] = regionSize;
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-	void* ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, newSize, ssboUsageFlags);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, bufferSize, NULL, ssboUsageFlags);
+	void* ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bufferSize, ssboUsageFlags);
 	for (uint16_t i = 1; ptr == nullptr; ++i) {
 		if (0 == i) throw std::runtime_error("GPU data upload failed. glMapBufferRange returned null pointer.");
-		ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, newSize, ssboUsageFlags | GL_MAP_INVALIDATE_BUFFER_BIT);
+		ptr = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bufferSize, ssboUsageFlags | GL_MAP_INVALIDATE_BUFFER_BIT);
 	}
-	typeToPersistentSSBOMap[type] = PersistentBuffer{ ssbo, ptr, newSize };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	typeToPersistentSSBOMap[type] = PersistentBuffer{ ssbo, ptr, bufferSize, regionSize };
 }
 
 void *OpenGLRenderer::getMappedSSBOData(uint16_t type, uint64_t maxSize) {
 	if (maxSize > typeToSSBOSize[type]) {
 		resizeSSBO(type, maxSize);
 	}
-	return typeToPersistentSSBOMap[type].mappedPtr;
+	PersistentBuffer& buffer = typeToPersistentSSBOMap[type];
+	return static_cast<char*>(buffer.mappedPtr) + ssboFrameIndex * buffer.regionSize;
 }
 
 void OpenGLRenderer::unmapSSBO(uint16_t type) {
@@ -228,40 +246,56 @@ void OpenGLRenderer::uploadUBOData(uint32_t binding, uint16_t type, uint32_t siz
 
 
 void OpenGLRenderer::BindSSBO(uint32_t binding, uint16_t type) {
-	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, typeToSSBOMap[type], 0, typeToSSBOSize[type]);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, typeToSSBOMap[type], ssboFrameIndex * typeToSSBOSize[type], typeToSSBOSize[type]);
 }
 
 void OpenGLRenderer::createObjectBuffer(Shape &shape, int32_t index_pointer_size, int32_t normal_pointer_size, float *normals, uint32_t *index_array, std::vector<float> objDataVector) {
-	unsigned int vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	unsigned int buffer_id;
+	if (shapeMeshMap.find(shape.shapeType) != shapeMeshMap.end()) return; // one mesh per shape type
+	// Append the mesh to the shared buffers. Both attribute streams get the same vertex count
+	// so one base vertex addresses them, the shorter one is padded with zeros.
+	uint32_t baseVertex = static_cast<uint32_t>(meshPositions.size() / 3);
+	uint32_t vertexCount = static_cast<uint32_t>(std::max<int32_t>(shape.size, normal_pointer_size) / 3);
+	meshPositions.insert(meshPositions.end(), objDataVector.begin(), objDataVector.begin() + shape.size);
+	meshPositions.resize((baseVertex + vertexCount) * 3, 0.f);
+	meshNormals.insert(meshNormals.end(), normals, normals + normal_pointer_size);
+	meshNormals.resize((baseVertex + vertexCount) * 3, 0.f);
+	float radiusSquared = 0.f;
+	for (int32_t i = 0; i + 2 < shape.size; i += 3) {
+		const float* p = &objDataVector[i];
+		radiusSquared = std::max(radiusSquared, p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+	}
+	MeshRange range{ static_cast<uint32_t>(meshIndices.size()), static_cast<uint32_t>(index_pointer_size), static_cast<int32_t>(baseVertex), std::sqrt(radiusSquared) };
+	meshIndices.insert(meshIndices.end(), index_array, index_array + index_pointer_size);
+	shapeMeshMap[shape.shapeType] = range;
 
-	glGenBuffers(1, &buffer_id);
-	glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
-	glBufferData(GL_ARRAY_BUFFER, shape.size * sizeof(float) + normal_pointer_size * sizeof(float), 0, GL_STATIC_DRAW);
+	// Meshes are only added at startup, so the buffers are simply rebuilt with everything so far
+	if (meshVAO == 0) {
+		glGenVertexArrays(1, &meshVAO);
+	}
+	GLuint oldBuffers[] = { meshPositionVBO, meshNormalVBO, meshIBO };
+	glDeleteBuffers(3, oldBuffers);
+	glBindVertexArray(meshVAO);
 
-	glBufferSubData(GL_ARRAY_BUFFER, 0, shape.size * sizeof(float), objDataVector.data());
+	glGenBuffers(1, &meshPositionVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, meshPositionVBO);
+	glBufferData(GL_ARRAY_BUFFER, meshPositions.size() * sizeof(float), meshPositions.data(), GL_STATIC_DRAW);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
 
-	glBufferSubData(GL_ARRAY_BUFFER, shape.size * sizeof(float), normal_pointer_size * sizeof(float), normals);
+	glGenBuffers(1, &meshNormalVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, meshNormalVBO);
+	glBufferData(GL_ARRAY_BUFFER, meshNormals.size() * sizeof(float), meshNormals.data(), GL_STATIC_DRAW);
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void*)(shape.size * sizeof(float)));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, 0);
 
-	//create a buffer for the indices
-	unsigned int ibo;
-	//glGenBuffers creates the random id for that buffer and stores it in the variable
-	glGenBuffers(1, &ibo);
-	//bind object buffer to target
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_pointer_size * sizeof(unsigned int), index_array, GL_STATIC_DRAW);
+	//create a buffer for the indices, the VAO keeps it bound
+	glGenBuffers(1, &meshIBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshIBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshIndices.size() * sizeof(uint32_t), meshIndices.data(), GL_STATIC_DRAW);
 
-	shapeVAOIDmap[shape.shapeType] = vao;
-	shapeVBOIDmap[shape.shapeType] = buffer_id;
-	shapeIBOIDmap[shape.shapeType] = ibo;
-	std::cout << "buffer created id's are:" << vao << ", " << buffer_id << ", " << ibo << std::endl;
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	std::cout << "mesh " << shape.shapeType << " added: first index " << range.firstIndex << ", base vertex " << range.baseVertex << std::endl;
 }
 void OpenGLRenderer::clear() {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -277,10 +311,31 @@ void OpenGLRenderer::render() {
 
 void OpenGLRenderer::renderBatch(int16_t shapeType, uint32_t ib_size, uint32_t amount, uint32_t baseInstance) {
 	BindShape(shapeType);
-	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, ib_size, GL_UNSIGNED_INT, nullptr, amount, baseInstance);
+	const MeshRange& range = shapeMeshMap[shapeType];
+	glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, ib_size, GL_UNSIGNED_INT,
+		reinterpret_cast<void*>(static_cast<uintptr_t>(range.firstIndex) * sizeof(uint32_t)), amount, range.baseVertex, baseInstance);
 }
 void OpenGLRenderer::drawElements(uint32_t ib_size) {
-	glDrawElements(GL_TRIANGLES, ib_size, GL_UNSIGNED_INT, nullptr);
+	const MeshRange& range = shapeMeshMap[boundShapeType];
+	glDrawElementsBaseVertex(GL_TRIANGLES, ib_size, GL_UNSIGNED_INT,
+		reinterpret_cast<void*>(static_cast<uintptr_t>(range.firstIndex) * sizeof(uint32_t)), range.baseVertex);
+}
+DrawElementsIndirectCommand OpenGLRenderer::getDrawCommand(int shapeType, uint32_t instanceCount, uint32_t baseInstance) {
+	const MeshRange& range = shapeMeshMap[shapeType];
+	return DrawElementsIndirectCommand{ range.indexCount, instanceCount, range.firstIndex, range.baseVertex, baseInstance };
+}
+void OpenGLRenderer::multiDrawIndirect(uint16_t type, uint32_t drawCount) {
+	glBindVertexArray(meshVAO);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, typeToSSBOMap[type]);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+		reinterpret_cast<void*>(static_cast<uintptr_t>(ssboFrameIndex) * typeToSSBOSize[type]), drawCount, sizeof(DrawElementsIndirectCommand));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+void OpenGLRenderer::dispatchCompute(uint32_t groupCount) {
+	if (groupCount > 0) {
+		glDispatchCompute(groupCount, 1, 1);
+	}
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 }
 void OpenGLRenderer::initShader(const std::string& path) {
 
@@ -296,6 +351,9 @@ void OpenGLRenderer::initShader(const std::string& vertPath, const std::string&
 	shaders.push_back(aShader);
 	shaders.back()->Bind();
 }
+void OpenGLRenderer::initComputeShader(const std::string& path) {
+	shaders.push_back(new GLSLShader{ path, GL_COMPUTE_SHADER });
+}
 void OpenGLRenderer::setShader(GLSLShader &shader, int shaderType) {
 	//shaders.at(shaderType) = shader;
 	shaders.at(shaderType) = &shader;
@@ -312,10 +370,29 @@ void OpenGLRenderer::unbindShader() {
 	glUseProgram(0);
 }
 
+void OpenGLRenderer::waitForFrameFence(uint32_t frameIndex) {
+	GLsync& fence = frameFences[frameIndex];
+	if (!fence) return;
+	// the first wait flushes, so the fence is sure to reach the GPU
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	while (result == GL_TIMEOUT_EXPIRED) {
+		result = glClientWaitSync(fence, 0, 1000000);
+	}
+	if (result == GL_WAIT_FAILED) {
+		std::cerr << "glClientWaitSync failed, the frame's SSBO region may still be in use" << std::endl;
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
 void OpenGLRenderer::beginFrame() {
+	// the region this frame writes was last used SSBO_FRAME_COUNT frames ago
+	waitForFrameFence(ssboFrameIndex);
 	clear();
 }
 void OpenGLRenderer::endFrame() {
+	frameFences[ssboFrameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ssboFrameIndex = (ssboFrameIndex + 1) % SSBO_FRAME_COUNT;
 	glfwSwapBuffers(window);
 	glfwPollEvents();
 }
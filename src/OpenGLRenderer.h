@@ -6,6 +6,26 @@
 #include <vector>
 #include <map>
 #include <string>
+
+/*
+Persistent SSBO ring
+- every persistent SSBO holds SSBO_FRAME_COUNT regions. Frame f writes and binds region f % SSBO_FRAME_COUNT,
+  so the CPU fills the next frame while the GPU still reads the previous ones.
+- endFrame fences the frame's draws, beginFrame waits for the fence of the region it is about to reuse.
+  With three regions that wait only blocks when the GPU is more than two frames behind.
+- getMappedSSBOData returns the current frame's region, which callers rewrite completely every frame
+*/
+#define SSBO_FRAME_COUNT 3
+
+/*
+Shared mesh buffers
+- every shape mesh is appended to one VAO with one position, one normal and one index buffer,
+  and remembers where it starts (MeshRange). Binding a shape never switches vertex state.
+- the batches are drawn with one glMultiDrawElementsIndirect over a persistent command buffer,
+  one DrawElementsIndirectCommand per shape type, so the draw calls don't grow with the shape types
+- a compute pass may fill the commands' instance counts on the GPU before the draw, see dispatchCompute
+*/
+
 class OpenGLRenderer : public Renderer
 {
 private:
@@ -14,13 +34,25 @@ private:
 	std::unordered_map<uint32_t, uint32_t> typeToUBOMap;
 	std::unordered_map<uint32_t, uint32_t> typeToUBOSize;
 	std::unordered_map<uint32_t, uint32_t> typeToSSBOMap;
-	std::unordered_map<uint32_t, uint32_t> typeToSSBOSize;
-	std::map<uint32_t, int> shapeVAOIDmap;
-	std::map<uint32_t, int> shapeVBOIDmap;
-	std::map<uint32_t, int> shapeIBOIDmap;
+	std::unordered_map<uint32_t, uint64_t> typeToSSBOSize;
+	std::map<uint32_t, MeshRange> shapeMeshMap;
+	GLuint meshVAO = 0;
+	GLuint meshPositionVBO = 0;
+	GLuint meshNormalVBO = 0;
+	GLuint meshIBO = 0;
+	std::vector<float> meshPositions; // CPU copies, the buffers are rebuilt when a mesh is added
+	std::vector<float> meshNormals;
+	std::vector<uint32_t> meshIndices;
+	int boundShapeType = -1; // mesh drawn by drawElements and renderBatch
 	std::vector<uint32_t> textures;
 	GLbitfield ssboUsageFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 	std::map<uint32_t, PersistentBuffer> typeToPersistentSSBOMap;
+	GLint ssboOffsetAlignment = 256; // queried in init
+	uint32_t ssboFrameIndex = 0; // region of the persistent SSBOs the current frame writes and binds
+	GLsync frameFences[SSBO_FRAME_COUNT] = {}; // signaled when the GPU is done with the frame that used the region
+	uint64_t alignRegionSize(uint64_t size) const;
+	void createPersistentBuffer(uint16_t type, uint64_t size);
+	void waitForFrameFence(uint32_t frameIndex);
 	//std::vector<GLuint> framebuffers;
 public:
 	OpenGLRenderer();
@@ -32,21 +64,26 @@ public:
 	void setShader(GLSLShader& shader, int shaderType);
 	void initShader(const std::string& path);
 	void initShader(const std::string& vertPath, const std::string& fragPath);
+	void initComputeShader(const std::string& path);
 	void loadTexture(const std::string &fileName) override;
 
 	void BindShader(int shaderType = 0);
+	inline bool hasShader(int shaderType) const { return shaderType < (int)shaders.size() && shaders[shaderType] && shaders[shaderType]->isValid(); }
 	void unbindShader();
-	void BindShape(int shapeType);
+	void BindShape(int shapeType) override;
 	void setViewport(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override;
 
 	void createUBO(uint32_t binding, uint16_t type, uint32_t size);
 	void createSSBO(uint32_t binding, uint16_t type, uint32_t size);
+	// Persistent ring of DrawElementsIndirectCommands, filled through getMappedSSBOData
+	void createIndirectBuffer(uint16_t type, uint32_t size);
 	void uploadUBOData(uint32_t binding, uint16_t type, uint32_t size, uint32_t offset, void *data);
 	// Is not needed as mapped pointer is used for SSBOs
 	//void uploadSSBOData(uint32_t binding, uint16_t type, uint32_t size, uint32_t offset, void *data);
 	// TODO: check with vulkan/dx12 to see if unmap is needed there. Add it to renderer?
+	// Current frame's region of the buffer, at least maxSize bytes
 	void* getMappedSSBOData(uint16_t type, uint64_t maxSize);
-	void resizeSSBO(uint16_t type, uint32_t newSize);
+	void resizeSSBO(uint16_t type, uint64_t newSize);
 	void unmapSSBO(uint16_t type);
 	void BindSSBO(uint32_t binding, uint16_t type);
 
@@ -61,6 +98,13 @@ public:
 	void endFrame() override;
 	void render() override;
 	void renderBatch(int16_t shapeType, uint32_t ib_size, uint32_t amount, uint32_t baseInstance);
+	// Draws instanceCount instances of the shape's mesh, the shader sees baseInstance + instance
+	DrawElementsIndirectCommand getDrawCommand(int shapeType, uint32_t instanceCount, uint32_t baseInstance);
+	// One draw call for the first drawCount commands of the current frame's region
+	void multiDrawIndirect(uint16_t type, uint32_t drawCount);
+	inline float getMeshRadius(int shapeType) { return shapeMeshMap[shapeType].boundingRadius; }
+	// Runs the bound compute shader, then makes its SSBO writes visible to shaders and indirect draws
+	void dispatchCompute(uint32_t groupCount);
 	void drawElements(uint32_t ib_size); // temporary to accelerate integration
 
 };
@@ -0,0 +1,168 @@
+#include "PairCache.h"
+#include <algorithm>
+#include <cmath>
+
+void PairCache::setBodyCount(uint32_t count) {
+	if (m_velocityVersion.size() < count) {
+		m_velocityVersion.resize(count, 0);
+	}
+}
+
+void PairCache::clear() {
+	m_entries.clear();
+	m_offsets.clear();
+	m_pending.clear();
+	m_events.clear();
+}
+
+void PairCache::beginFrame(float speedFactor) {
+	++m_frame;
+	m_speedFactor = speedFactor;
+}
+
+PairCache::Entry* PairCache::find(uint32_t low, uint32_t high) {
+	if (low + 1 >= m_offsets.size()) return nullptr;
+	// the entries of one body are sorted by their other body
+	Entry* first = m_entries.data() + m_offsets[low];
+	Entry* last = m_entries.data() + m_offsets[low + 1];
+	Entry* entry = std::lower_bound(first, last, high, [](const Entry& e, uint32_t value) { return e.high < value; });
+	return entry != last && entry->high == high ? entry : nullptr;
+}
+
+bool PairCache::trySkip(uint32_t a, uint32_t b, const float* velX, const float* velY, const float* velZ) {
+	uint32_t low = a < b ? a : b;
+	uint32_t high = a < b ? b : a;
+	Entry* entry = find(low, high);
+	if (!entry) return false;
+	entry->frame = m_frame;
+
+	if (entry->touching || entry->skipped >= MAX_SKIP_FRAMES ||
+		entry->versionLow != m_velocityVersion[low] || entry->versionHigh != m_velocityVersion[high]) {
+		return false;
+	}
+
+	const float* vel = entry->axis == 0 ? velX : entry->axis == 1 ? velY : velZ;
+	float gap = entry->gap - std::abs(vel[low] - vel[high]) * m_speedFactor;
+	if (gap <= GAP_MARGIN) return false;
+
+	entry->gap = gap;
+	entry->skipped++;
+	entry->touchingNow = 0;
+	return true;
+}
+
+void PairCache::record(uint32_t a, uint32_t b, bool touching, float gap, uint8_t axis, std::vector<PendingPair>& pending) {
+	uint32_t low = a < b ? a : b;
+	uint32_t high = a < b ? b : a;
+	Entry* entry = find(low, high);
+	if (!entry) {
+		if (touching || gap < TRACK_MARGIN) {
+			pending.push_back(PendingPair{ low, high, gap, m_velocityVersion[low], m_velocityVersion[high], axis, touching });
+		}
+		return;
+	}
+	entry->frame = m_frame;
+	entry->gap = gap;
+	entry->axis = axis;
+	entry->versionLow = m_velocityVersion[low];
+	entry->versionHigh = m_velocityVersion[high];
+	entry->skipped = 0;
+	entry->touchingNow = touching;
+}
+
+void PairCache::insert(const std::vector<PendingPair>& pending) {
+	m_pending.insert(m_pending.end(), pending.begin(), pending.end());
+}
+
+void PairCache::endFrame(const uint8_t* awake) {
+	m_events.clear();
+	m_spare.clear();
+
+	// m_entries is sorted, so the surviving entries stay sorted
+	for (Entry& entry : m_entries) {
+		if (entry.frame != m_frame && awake && !awake[entry.low] && !awake[entry.high]) {
+			if (entry.touching) {
+				m_events.push_back(ContactEvent{ entry.low, entry.high, CONTACT_PERSIST });
+			}
+			m_spare.push_back(entry);
+			continue;
+		}
+		bool candidate = entry.frame == m_frame;
+		bool touchingNow = candidate && entry.touchingNow;
+		if (touchingNow) {
+			m_events.push_back(ContactEvent{ entry.low, entry.high, entry.touching ? CONTACT_PERSIST : CONTACT_BEGIN });
+		}
+		else if (entry.touching) {
+			m_events.push_back(ContactEvent{ entry.low, entry.high, CONTACT_END });
+		}
+		if (candidate && (touchingNow || entry.gap < TRACK_MARGIN)) {
+			entry.touching = touchingNow;
+			m_spare.push_back(entry);
+		}
+	}
+	size_t kept = m_spare.size();
+
+	// pending pairs come from several threads, so their order isn't reproducible until sorted
+	for (const PendingPair& pair : m_pending) {
+		if (pair.touching) {
+			m_events.push_back(ContactEvent{ pair.low, pair.high, CONTACT_BEGIN });
+		}
+		m_spare.push_back(Entry{ pair.low, pair.high, pair.gap, pair.versionLow, pair.versionHigh,
+			m_frame, pair.axis, 0, pair.touching, pair.touching });
+	}
+	m_pending.clear();
+	auto byPair = [](const Entry& a, const Entry& b) { return a.low != b.low ? a.low < b.low : a.high < b.high; };
+	std::sort(m_spare.begin() + kept, m_spare.end(), byPair);
+	std::inplace_merge(m_spare.begin(), m_spare.begin() + kept, m_spare.end(), byPair);
+	m_entries.swap(m_spare);
+
+	buildOffsets();
+
+	std::sort(m_events.begin(), m_events.end(), [](const ContactEvent& a, const ContactEvent& b) {
+		return a.first != b.first ? a.first < b.first : a.second < b.second;
+	});
+}
+
+void PairCache::remap(const std::vector<uint32_t>& newIndex) {
+	for (Entry& entry : m_entries) {
+		uint32_t low = newIndex[entry.low];
+		uint32_t high = newIndex[entry.high];
+		if (low > high) {
+			std::swap(low, high);
+			std::swap(entry.versionLow, entry.versionHigh);
+		}
+		entry.low = low;
+		entry.high = high;
+	}
+	std::sort(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) {
+		return a.low != b.low ? a.low < b.low : a.high < b.high;
+	});
+	buildOffsets();
+
+	std::vector<uint32_t> versions(m_velocityVersion.size());
+	for (size_t body = 0; body < m_velocityVersion.size(); ++body) {
+		versions[newIndex[body]] = m_velocityVersion[body];
+	}
+	m_velocityVersion.swap(versions);
+
+	for (ContactEvent& event : m_events) {
+		uint32_t first = newIndex[event.first];
+		uint32_t second = newIndex[event.second];
+		event.first = first < second ? first : second;
+		event.second = first < second ? second : first;
+	}
+	std::sort(m_events.begin(), m_events.end(), [](const ContactEvent& a, const ContactEvent& b) {
+		return a.first != b.first ? a.first < b.first : a.second < b.second;
+	});
+}
+
+// counting pass over the sorted entries
+void PairCache::buildOffsets() {
+	m_offsets.assign(m_velocityVersion.size() + 1, 0);
+	for (const Entry& entry : m_entries) {
+		++m_offsets[entry.low + 1];
+	}
+	for (size_t i = 1; i < m_offsets.size(); ++i) {
+		m_offsets[i] += m_offsets[i - 1];
+	}
+}
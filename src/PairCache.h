@@ -0,0 +1,96 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+enum ContactEventType : uint8_t {
+	CONTACT_BEGIN = 0,
+	CONTACT_PERSIST,
+	CONTACT_END
+};
+
+struct ContactEvent {
+	uint32_t first; // lower body index
+	uint32_t second;
+	ContactEventType type;
+};
+
+/*
+Persistent pair cache
+- keeps the broadphase pairs that touch or whose predicted boxes are less than TRACK_MARGIN apart.
+  Pairs further apart are rejected by the narrowphase early out for less than a lookup would cost.
+- a pair that missed keeps the distance between its boxes along the axis that separates them.
+  While neither body's speed changes, that distance only shrinks by the relative speed along the
+  axis each frame, so the narrowphase is skipped until it could have closed
+- the contact state of the previous frame gives begin/persist/end transitions
+- entries are sorted by pair and indexed by the lower body, so a lookup only searches the entries of one body
+- lookups and updates of existing entries are safe from several threads, as long as every pair is
+  handled by a single thread per frame. New pairs are queued by the caller and added with insert().
+*/
+class PairCache {
+public:
+	// A pair seen for the first time this frame, added by insert()
+	struct PendingPair {
+		uint32_t low;
+		uint32_t high;
+		float gap;
+		uint32_t versionLow;
+		uint32_t versionHigh;
+		uint8_t axis;
+		uint8_t touching;
+	};
+
+	static constexpr float TRACK_MARGIN = 2.f;
+	// Skips are capped so rounding in the integrated positions can never add up past GAP_MARGIN
+	static constexpr uint8_t MAX_SKIP_FRAMES = 8;
+	static constexpr float GAP_MARGIN = 1e-3f;
+
+	void setBodyCount(uint32_t count);
+	// Has to be called whenever a body's speed is changed by anything but integration
+	inline void touchBody(uint32_t body) { ++m_velocityVersion[body]; }
+	void clear();
+	// Renames every body to newIndex[body], for when the body storage is reordered
+	void remap(const std::vector<uint32_t>& newIndex);
+
+	// speedFactor scales speeds to the displacement of the integration step that just ran
+	void beginFrame(float speedFactor);
+
+	// Returns true if the pair is provably still apart and doesn't need a narrowphase test this frame
+	bool trySkip(uint32_t a, uint32_t b, const float* velX, const float* velY, const float* velZ);
+	// Stores the narrowphase result. gap and axis are the box separation, only used on a miss.
+	void record(uint32_t a, uint32_t b, bool touching, float gap, uint8_t axis, std::vector<PendingPair>& pending);
+	void insert(const std::vector<PendingPair>& pending);
+
+	// Drops pairs that weren't candidates this frame or moved out of range, and builds the contact events.
+	// Pairs of two sleeping bodies (awake is indexed by body) are kept as they are.
+	void endFrame(const uint8_t* awake = nullptr);
+
+	// Sorted by pair
+	inline const std::vector<ContactEvent>& getEvents() const { return m_events; }
+	inline uint32_t getPairCount() const { return static_cast<uint32_t>(m_entries.size()); }
+
+private:
+	struct Entry {
+		uint32_t low;
+		uint32_t high;
+		float gap;            // box separation along axis, minus the motion of the skipped frames
+		uint32_t versionLow;  // velocity versions of both bodies when the gap was measured
+		uint32_t versionHigh;
+		uint32_t frame;       // last frame the pair was a candidate
+		uint8_t axis;
+		uint8_t skipped;      // frames skipped since the last test
+		uint8_t touching;     // contact state of the previous frame
+		uint8_t touchingNow;
+	};
+
+	std::vector<Entry> m_entries;    // sorted by (low, high)
+	std::vector<uint32_t> m_offsets; // first entry of every low body index, body count + 1 long
+	std::vector<Entry> m_spare;      // the next m_entries is built here
+	std::vector<PendingPair> m_pending;
+	uint32_t m_frame = 0;
+	float m_speedFactor = 0.f;
+	std::vector<uint32_t> m_velocityVersion; // by body index
+	std::vector<ContactEvent> m_events;
+
+	Entry* find(uint32_t low, uint32_t high);
+	void buildOffsets();
+};
@@ -0,0 +1,55 @@
+#include "RadixSorter.h"
+#include <algorithm>
+
+void RadixSorter::sort(ThreadPool& pool, std::vector<uint64_t>& items, uint32_t firstBit, uint32_t bitCount) {
+	const uint32_t count = static_cast<uint32_t>(items.size());
+	if (count < 2 || bitCount == 0) return;
+	const uint32_t blockCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	m_scratch.resize(count);
+	m_offsets.resize(blockCount * BUCKET_COUNT);
+
+	uint64_t* source = items.data();
+	uint64_t* target = m_scratch.data();
+	for (uint32_t shift = firstBit; shift < firstBit + bitCount; shift += DIGIT_BITS) {
+		// the last digit can be narrower than DIGIT_BITS
+		const uint32_t digitBits = std::min(DIGIT_BITS, firstBit + bitCount - shift);
+		const uint64_t digitMask = (1ull << digitBits) - 1;
+		pool.parallelFor(0, blockCount, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t block = begin; block < end; ++block) {
+				uint32_t* histogram = &m_offsets[block * BUCKET_COUNT];
+				std::fill(histogram, histogram + BUCKET_COUNT, 0u);
+				uint32_t last = std::min(count, (block + 1) * BLOCK_SIZE);
+				for (uint32_t i = block * BLOCK_SIZE; i < last; ++i) {
+					++histogram[(source[i] >> shift) & digitMask];
+				}
+			}
+		});
+
+		// exclusive prefix sum, bucket major so every block scatters behind the blocks before it
+		uint32_t sum = 0;
+		for (uint32_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+			for (uint32_t block = 0; block < blockCount; ++block) {
+				uint32_t& offset = m_offsets[block * BUCKET_COUNT + bucket];
+				uint32_t itemsInBucket = offset;
+				offset = sum;
+				sum += itemsInBucket;
+			}
+		}
+
+		pool.parallelFor(0, blockCount, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t block = begin; block < end; ++block) {
+				uint32_t* offsets = &m_offsets[block * BUCKET_COUNT];
+				uint32_t last = std::min(count, (block + 1) * BLOCK_SIZE);
+				for (uint32_t i = block * BLOCK_SIZE; i < last; ++i) {
+					target[offsets[(source[i] >> shift) & digitMask]++] = source[i];
+				}
+			}
+		});
+		std::swap(source, target);
+	}
+
+	// an odd number of passes leaves the result in the scratch buffer
+	if (source != items.data()) {
+		items.swap(m_scratch);
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "ThreadPool.h"
+#include <vector>
+#include <cstdint>
+
+/*
+Parallel LSD radix sort of 64 bit items by a bit range of each item
+- 8 bit digits, one histogram and one scatter pass per digit over fixed size blocks, so the
+  result doesn't depend on how many threads the pool has or which thread ran which block
+- stable: items with equal keys keep their order
+- the scratch buffers keep their capacity between sorts
+*/
+class RadixSorter {
+public:
+	static constexpr uint32_t DIGIT_BITS = 8;
+	static constexpr uint32_t BUCKET_COUNT = 1u << DIGIT_BITS;
+	static constexpr uint32_t BLOCK_SIZE = 16384; // items per histogram block
+
+	// Sorts items by bits [firstBit, firstBit + bitCount)
+	void sort(ThreadPool& pool, std::vector<uint64_t>& items, uint32_t firstBit, uint32_t bitCount);
+
+private:
+	std::vector<uint64_t> m_scratch;
+	std::vector<uint32_t> m_offsets; // BUCKET_COUNT per block: item count, then scatter offset
+};
@@ -1,9 +1,11 @@
 #pragma once
 #include <string>
 #include <cstdint>
+#include <cstddef>
 #include <vector>
 #include "Shape.h"
-#include <GLFW/glfw3.h>
+
+struct GLFWwindow;
 
 /// Abstract Renderer Interface
 class Renderer
@@ -27,6 +29,7 @@ public:
     virtual void loadTexture(const std::string& filePath) = 0;
 
 	virtual void createObjectBuffer(Shape &shape, int32_t index_pointer_size, int32_t normal_pointer_size, float* normals, uint32_t* index_array, std::vector<float> objDataVector) = 0;
+	virtual void BindShape(int shapeType) = 0;
 
     // Window resizing
 	//virtual void resize(uint16_t newWidth, uint16_t newHeight) = 0; // optional for now
@@ -42,7 +45,24 @@ public:
 struct PersistentBuffer {
 	uint32_t bufferID;
 	void* mappedPtr;
-	uint64_t size;
+	uint64_t size;       // whole buffer, one region per frame in flight
+	uint64_t regionSize; // one frame's region, a multiple of the ssbo offset alignment
+};
+// Layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	uint32_t count;         // indices per instance
+	uint32_t instanceCount;
+	uint32_t firstIndex;    // into the shared index buffer
+	int32_t baseVertex;     // added to every index
+	uint32_t baseInstance;  // first instance, offsets the per-body SSBOs
+};
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "cull_shader.slang reads the commands as COMMAND_WORDS words");
+// Where a mesh lives in the shared vertex and index buffers
+struct MeshRange {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t baseVertex;
+	float boundingRadius; // of the unscaled mesh around its origin
 };
 struct colorData {
 	glm::vec4 color;
@@ -51,24 +71,36 @@ struct camLightPositions {
     glm::vec4 camPos;
     glm::vec4 lightPos;
 };
+// Input of the culling pass, the batch instances [typeFirst, typeEnd) of each shape type are tested
+struct cullParams {
+    glm::vec4 planes[6]; // frustum planes, inside where dot(xyz, p) + w >= 0
+    uint32_t typeFirst[SHAPE_TYPE_COUNT];
+    uint32_t typeEnd[SHAPE_TYPE_COUNT];
+    float typeRadius[SHAPE_TYPE_COUNT]; // bounding radius of the shape type's mesh
+    uint32_t instanceCount; // of the whole batch
+    uint32_t padding[3];
+};
+static_assert(SHAPE_TYPE_COUNT == 4, "cullParams packs one uint4/float4 per field, see cull_shader.slang");
+// CullParams in cull_shader.slang, std140
+static_assert(offsetof(cullParams, typeFirst) == 96 && offsetof(cullParams, typeEnd) == 112 && offsetof(cullParams, typeRadius) == 128 &&
+    offsetof(cullParams, instanceCount) == 144 && sizeof(cullParams) == 160, "cullParams must match the cull shader");
 
 enum BufferUsage {
     MODEL_MATRIX,
 	OBJ_COLOR,
     CAM_LIGHT_POSITIONS,
 	IS_TEXTURE,
-    CUBE_MATRICES,
-    SPHERE_MATRICES,
-    CYLINDER_MATRICES,
-    RING_MATRICES,
-    CUBE_COLORS,
-    SPHERE_COLORS,
-    CYLINDER_COLORS,
-    RING_COLORS 
+    BATCH_INSTANCES, // every shape type back to back, in T_CUBE..T_RING order
+    BATCH_COLORS,
+    DRAW_COMMANDS,
+    VIEW_PROJECTION,
+    CULL_PARAMS,
+    VISIBLE_INSTANCES // batch instance indices that passed culling, written on the GPU
 };
 
 enum ShaderTypes {
     SIMPLE_SHADER = 0,
     TEXTURE_SHADER,
-    BATCH_SHADER
+    BATCH_SHADER,
+    CULL_SHADER
 };
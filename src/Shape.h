@@ -1,5 +1,9 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <cstddef>
+
+#define SQRT_2 1.41421356237f
 
 enum ShapeType {
 	T_CUBE = 0,
@@ -7,6 +11,7 @@ enum ShapeType {
 	T_CYLINDER,
 	T_RING
 };
+constexpr int SHAPE_TYPE_COUNT = T_RING + 1;
 
 struct objMatrices {
 	glm::mat4 mvp{ 1.f }; // 4x4 floats x4 bytes = 64 bytes
@@ -14,6 +19,14 @@ struct objMatrices {
 	glm::mat3x4 normalModel{ 1.f }; // 3x4floats x 4 bytes = 48 + 128 = 176 bytes
 };
 
+// Per body record of the batch shader, which rebuilds model, normal and MVP matrices from it
+struct InstanceData {
+	float center[3];
+	uint32_t scale; // half floats, x (which is also z) in the low 16 bits and y in the high 16 bits. 16 bytes
+};
+// Instance in batch_common.slang reads it with the std430 layout
+static_assert(sizeof(InstanceData) == 16 && offsetof(InstanceData, scale) == 12, "InstanceData must match the batch shader");
+
 struct Shape {
 	int size = 0;
 	int shapeType = -1;
@@ -9,7 +9,7 @@
 	back: 0123, front: 4567, left: 0145, right: 2367, bottom: 4062, top: 5173
 	The only easy enough to do by hand
 */
-ShapeFactory::ShapeFactory():cube_indices{
+ShapeFactory::ShapeFactory(ShapePool* pool):shapePool(pool), cube_indices{
 	4, 6, 5,//front
 	7, 5, 6,//front
 	0, 1, 2,//back
@@ -55,20 +55,23 @@ ShapeFactory::ShapeFactory():cube_indices{
 
 }
 {
+	generator.seed(static_cast<uint32_t>(std::chrono::system_clock::now().time_since_epoch().count()));
 	InitSphereIndices();
 	InitCylinderIndices();
 }
-void ShapeFactory::setRenderer(OpenGLRenderer* rend) {
+void ShapeFactory::setRenderer(Renderer* rend) {
 	renderer = rend;
 }
 
 
 void ShapeFactory::InitPrototypes()
 {
-	Prototypes.push_back(CreateCube(0.f, 0.f, 0.f, 2.f));
-	Prototypes.push_back(CreateSphere(0.f, 0.f, 0.f, 1.f));
-	Prototypes.push_back(CreateCylinder(0.f, 0.f, 0.f, 1.f, 1.f));
-	Prototypes.push_back(CreateRing(0.f, 0.f, 0.f, 1.0f, 0.3f));
+	Shape* created[4] = { &CreateCube(0.f, 0.f, 0.f, 2.f), &CreateSphere(0.f, 0.f, 0.f, 1.f),
+		&CreateCylinder(0.f, 0.f, 0.f, 1.f, 1.f), &CreateRing(0.f, 0.f, 0.f, 1.0f, 0.3f) };
+	for (Shape* shape : created) {
+		Prototypes.push_back(*shape);
+		shapePool->release(shape);
+	}
 }
 
 void ShapeFactory::InitSphereIndices() {
@@ -143,8 +146,8 @@ Buffer Binder
 - created mainly because it removes 2 - 3 Getters / Setters
 - TODO: replace with renderer.bindShape(shape.vao_id, shape_ib_id); or just do a batch draw.
 */
-void ShapeFactory::BindShape(const Shape& shape) {
-	renderer->BindShape(shape.shapeType);
+void ShapeFactory::BindShape(int shapeType) {
+	if (renderer) renderer->BindShape(shapeType);
 }
 
 Shape& ShapeFactory::CreateRandomShape(float x, float y, float z, float maxSize) {
@@ -308,7 +311,7 @@ Shape& ShapeFactory::CreateRing(float x,float y, float z, float r1, float r2) {
 	glm::mat4 model{ 1.f };
 	model = glm::translate(model, glm::vec3{ x, y, z });
 	model = glm::scale(model, glm::vec3{ r1, 4*r2, r1 });
-	Shape* tempShapePtr = new Shape{ Prototypes.at(T_RING) };
+	Shape* tempShapePtr = shapePool->allocate(Prototypes.at(T_RING));
 	Shape& tempShape = *tempShapePtr;
 	tempShape.scale = glm::vec3{ r1, 4 * r2, r1 };
 	tempShape.matrices.model = model;
@@ -392,7 +395,7 @@ Shape& ShapeFactory::CreateCube(float x0, float y0, float z0, float size) {
 	glm::mat4 model{ 1.f };
 	model = glm::translate(model, glm::vec3{ x0, y0, z0 });
 	model = glm::scale(model, glm::vec3{ size * .5f, size * .5f, size * .5f });
-	Shape* tempShapePtr = new Shape{ Prototypes.at(T_CUBE) };
+	Shape* tempShapePtr = shapePool->allocate(Prototypes.at(T_CUBE));
 	Shape& tempShape = *tempShapePtr;
 	tempShape.scale = glm::vec3{ size * .5f, size * .5f, size * .5f };
 	tempShape.matrices.model = model;
@@ -450,7 +453,7 @@ Shape& ShapeFactory::CreateSphere(float x0, float y0, float z0, float radius) {
 	glm::mat4 model{ 1.f };
 	model = glm::translate(model, glm::vec3{ x0, y0, z0 });
 	model = glm::scale(model, glm::vec3{ radius, radius, radius });
-	Shape* tempShapePtr = new Shape{ Prototypes.at(T_SPHERE) };
+	Shape* tempShapePtr = shapePool->allocate(Prototypes.at(T_SPHERE));
 	Shape& tempShape = *tempShapePtr;
 	tempShape.scale = glm::vec3{ radius, radius, radius };
 	tempShape.matrices.model = model;
@@ -495,7 +498,7 @@ Shape& ShapeFactory::CreateCylinder(float x, float y, float z, float radius, flo
 	model = glm::translate(model, glm::vec3{ x, y, z });
 	model = glm::scale(model, glm::vec3{ radius, height, radius });
 	Shape prototype = Prototypes.at(T_CYLINDER);
-	Shape* tempShapePtr = new Shape{ prototype };
+	Shape* tempShapePtr = shapePool->allocate(prototype);
 	Shape& tempShape = *tempShapePtr;
 	tempShape.scale = glm::vec3{ radius, height , radius };
 	tempShape.matrices.model = model;
@@ -508,14 +511,14 @@ Shape& ShapeFactory::CreateCylinder(float x, float y, float z, float radius, flo
 
 }
 
-// Creates an Object and its GPU buffer
+// Creates an Object and its GPU buffer (if a renderer is set)
 Shape& ShapeFactory::CreateShapeObject(float * element, int elementSize, int shapeType, float x0, float y0, float z0, float d) {
 	std::vector<float> dataVector;
 	dataVector.reserve(elementSize);
 	for (int i = 0; i < elementSize; i++) {
 		dataVector.push_back(element[i]);
 	}
-	Shape* tempShapePtr = new Shape();
+	Shape* tempShapePtr = shapePool->allocate(Shape{});
 	Shape& tempShape = *tempShapePtr; // trick for heap allocation
 	tempShape.scale = glm::vec3{ 1.f, 1.f, 1.f };
 	tempShape.size = elementSize;
@@ -534,7 +537,9 @@ Shape& ShapeFactory::CreateShapeObject(float * element, int elementSize, int sha
 	float* normals = GetNormals(tempShape.shapeType);
 	uint32_t *index_array = GetIndexPointer(tempShape.shapeType);
 
-	renderer->createObjectBuffer(tempShape, index_pointer_size, normal_pointer_size, normals, index_array, dataVector);
+	if (renderer) {
+		renderer->createObjectBuffer(tempShape, index_pointer_size, normal_pointer_size, normals, index_array, dataVector);
+	}
 
 	return tempShape;
 }
@@ -552,17 +557,25 @@ float* ShapeFactory::GetColor(Shape& shape) {
 - just sets rgba color of shape at index
 */
 void ShapeFactory::SetColor(Shape& shape, float r_value, float g_value, float b_value, float alpha_value) {
-	shape.color[0] = r_value;
-	shape.color[1] = g_value;
-	shape.color[2] = b_value;
-	shape.color[3] = alpha_value;
+	SetColor(shape.color, r_value, g_value, b_value, alpha_value);
+}
+
+void ShapeFactory::SetColor(float* color, float r_value, float g_value, float b_value, float alpha_value) {
+	color[0] = r_value;
+	color[1] = g_value;
+	color[2] = b_value;
+	color[3] = alpha_value;
 }
 
 void ShapeFactory::SetRandomColor(Shape& shape, float alpha_value) {
-	shape.color[0] = RandomFloat(0.0f, 1.0f);
-	shape.color[1] = RandomFloat(0.0f, 1.0f);
-	shape.color[2] = RandomFloat(0.0f, 1.0f);
-	shape.color[3] = alpha_value;
+	SetRandomColor(shape.color, alpha_value);
+}
+
+void ShapeFactory::SetRandomColor(float* color, float alpha_value) {
+	color[0] = RandomFloat(0.0f, 1.0f);
+	color[1] = RandomFloat(0.0f, 1.0f);
+	color[2] = RandomFloat(0.0f, 1.0f);
+	color[3] = alpha_value;
 
 }
 
@@ -620,16 +633,16 @@ uint32_t *ShapeFactory::GetIndexPointer(int shapeType) {
 
 //Random number generators
 // TODO: replace with a static random class.
+void ShapeFactory::SetSeed(uint32_t seed) {
+	generator.seed(seed);
+}
+
 int ShapeFactory::RandomInt(int min, int max) {
-	uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
-	std::default_random_engine generator(static_cast<uint32_t>(seed));
 	std::uniform_int_distribution<int> distributionInteger(min, max);
 	return distributionInteger(generator);
 }
 
 float ShapeFactory::RandomFloat(float min, float max) {
-	uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
-	std::default_random_engine generator(static_cast<uint32_t> (seed));
 	std::uniform_real_distribution<float> distributionDouble(min, max);
 	return static_cast<float>(distributionDouble(generator));
 }
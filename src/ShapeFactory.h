@@ -1,7 +1,9 @@
 #pragma once
-#include "opengl.h"
-#include "OpenGLRenderer.h"
+#include "Renderer.h"
 #include "Shape.h"
+#include "ShapePool.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <cstdlib>
 #include <chrono>
 #include <random>
@@ -10,7 +12,6 @@
 #include <array>
 
 #define PI 3.14159265f
-#define SQRT_2 1.41421356237f
 
 #define CIRCLE_VERTEX_NUM (CIRCLE_TRIANGLE_NUM+2)
 
@@ -23,7 +24,8 @@
 class ShapeFactory {
 private:
 	std::vector<Shape> Prototypes;
-	OpenGLRenderer* renderer = nullptr; // Deprecated: moved to renderer class
+	Renderer* renderer = nullptr; // optional, without one no GPU buffers are created (headless runs)
+	ShapePool* shapePool; // every returned Shape lives here, the caller releases it
 	
 	//Normals
 /*
@@ -66,26 +68,30 @@ private:
 	Shape& CreateCylinder(float x, float y, float z, float radius, float height);
 	Shape& CreateRing(float x0, float y0, float z0, float r1, float r2);
 
+	std::default_random_engine generator; // seeded from the clock unless SetSeed is called
 	int RandomInt(int min, int max); // DEBUG: Move to another class
 	float RandomFloat(float min, float max); // and this
 
 public:
-	ShapeFactory();
-	void setRenderer(OpenGLRenderer* rend);
+	ShapeFactory(ShapePool* pool);
+	void setRenderer(Renderer* rend);
 	void InitPrototypes();
+	void SetSeed(uint32_t seed); // makes the random shapes reproducible
 
 	uint32_t GetIndexPointerSize(uint32_t shapeType);
 	int32_t GetNormalPointerSize(int32_t shapeType);
 	float* GetNormals(int shapeType);
 
-	void BindShape(const Shape& shape); // Move to Renderer Class
+	void BindShape(int shapeType); // Move to Renderer Class
 
 	Shape& CreateRandomShape(float x = 0.f, float y = 0.f, float z = 0.f, float maxSize = 10.f);
 	Shape& CreateShape(float x, float y, float z, float size, int ShapeType);
 
 	// Color handlers, DEBUG: Move to another class
 	void SetRandomColor(Shape& shape, float alpha_value = 1.0f);
+	void SetRandomColor(float* color, float alpha_value = 1.0f);
 	float* GetColor(Shape& shape);
 	void SetColor(Shape& shape, float r_value, float g_value, float b_value, float alpha_value);
+	void SetColor(float* color, float r_value, float g_value, float b_value, float alpha_value);
 	
 };
\ No newline at end of file
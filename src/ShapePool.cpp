@@ -0,0 +1,35 @@
+#include "ShapePool.h"
+#include <new>
+#include <type_traits>
+
+// released shapes are never destroyed, their slot is simply handed out again
+static_assert(std::is_trivially_destructible_v<Shape>, "ShapePool expects a trivially destructible Shape");
+
+Shape* ShapePool::allocate(const Shape& value) {
+	if (!m_freeList) {
+		grow();
+	}
+	Slot* slot = m_freeList;
+	m_freeList = slot->next;
+	++m_liveCount;
+	return new (slot->storage) Shape(value);
+}
+
+void ShapePool::release(Shape* shape) {
+	if (!shape) return;
+	Slot* slot = reinterpret_cast<Slot*>(shape);
+	slot->next = m_freeList;
+	m_freeList = slot;
+	--m_liveCount;
+}
+
+// Threads a new chunk onto the free list, first slot first
+void ShapePool::grow() {
+	std::unique_ptr<Slot[]> chunk(new Slot[CHUNK_SIZE]);
+	for (uint32_t i = 0; i + 1 < CHUNK_SIZE; ++i) {
+		chunk[i].next = &chunk[i + 1];
+	}
+	chunk[CHUNK_SIZE - 1].next = m_freeList;
+	m_freeList = &chunk[0];
+	m_chunks.push_back(std::move(chunk));
+}
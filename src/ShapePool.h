@@ -0,0 +1,40 @@
+#pragma once
+#include "Shape.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+/*
+Shape pool
+- hands out Shape slots from fixed size chunks, so creating bodies doesn't call malloc once per shape
+- released slots go on an intrusive free list and are handed out again first.
+  allocate and release are O(1).
+- chunks are only given back to the heap when the pool is destroyed
+*/
+class ShapePool {
+public:
+	static constexpr uint32_t CHUNK_SIZE = 1024; // shapes per chunk
+
+	ShapePool() = default;
+	ShapePool(const ShapePool&) = delete;
+	ShapePool& operator=(const ShapePool&) = delete;
+
+	// Copy constructs value into a free slot
+	Shape* allocate(const Shape& value);
+	void release(Shape* shape);
+
+	inline uint32_t getLiveCount() const { return m_liveCount; }
+	inline uint32_t getCapacity() const { return static_cast<uint32_t>(m_chunks.size()) * CHUNK_SIZE; }
+
+private:
+	union Slot {
+		Slot* next; // while the slot is free
+		alignas(Shape) unsigned char storage[sizeof(Shape)];
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> m_chunks;
+	Slot* m_freeList = nullptr;
+	uint32_t m_liveCount = 0;
+
+	void grow();
+};
@@ -1,7 +1,22 @@
 #pragma once
-#include <unordered_map>
 #include <vector>
+#include <cstdint>
+#include <climits>
+#include <cmath>
 
+// Rebuild-per-frame uniform grid with a counting sort layout.
+// Usage per frame: clear() -> insert() every object -> build() -> queryNeighbors().
+// All objects end up in one sorted index array, with one start offset per cell, so there are
+// no per-cell allocations and the vectors keep their capacity between frames.
+//
+// Dense mode covers a fixed box (positions outside of it are clamped into the border cells).
+// Sparse mode is for unbounded worlds: occupied cells are found through an open addressed
+// hash table that is rebuilt together with the grid.
+//
+// Linked mode (dense only) keeps objects between frames instead: every cell heads an intrusive
+// doubly linked list through per-object links, so moving an object to another cell is O(1) and
+// only objects that change cells have to be touched. Usage: clear() once -> insert() new objects,
+// move() the ones needsMove() reports -> queryNeighbors().
 class SpatialGrid {
 private:
     struct GridKey {
@@ -12,39 +27,255 @@ private:
         }
     };
 
-    struct GridKeyHash {
-        size_t operator()(const GridKey& k) const {
-            return ((size_t)k.x * 73856093) ^
-                ((size_t)k.y * 19349663) ^
-                ((size_t)k.z * 83492791);
-        }
-    };
+    static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
 
     float m_cellSize;
-    std::unordered_map<GridKey, std::vector<uint32_t>, GridKeyHash> m_cells;
+    float m_invCellSize;
+    bool m_dense = false;
+    bool m_linked = false;
+
+    // dense mode bounds, in cells
+    int m_lo[3] = { 0, 0, 0 };
+    int m_dims[3] = { 0, 0, 0 };
+
+    // per inserted object
+    std::vector<uint32_t> m_entryObject;
+    std::vector<GridKey> m_entryKey;
+    std::vector<uint32_t> m_entryCell;
+
+    // counting sort output: objects of cell c are m_sortedObjects[m_cellStart[c] .. m_cellStart[c + 1])
+    std::vector<uint32_t> m_cellStart;
+    std::vector<uint32_t> m_cellCursor;
+    std::vector<uint32_t> m_sortedObjects;
+
+    // sparse mode hash table, slot index doubles as the cell index
+    std::vector<GridKey> m_slotKey;
+    std::vector<uint32_t> m_slotUsed;
+    uint32_t m_slotMask = 0;
+
+    // linked mode, cell heads by dense cell index and links by object index
+    std::vector<uint32_t> m_cellHead;
+    std::vector<uint32_t> m_objectNext;
+    std::vector<uint32_t> m_objectPrev;
+    std::vector<GridKey> m_objectKey;
+
+    static uint32_t hashKey(const GridKey& k) {
+        uint32_t h = (uint32_t)k.x * 73856093u ^ (uint32_t)k.y * 19349663u ^ (uint32_t)k.z * 83492791u;
+        // murmur3 finalizer, the raw XOR of primes clusters badly on neighboring cells
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
 
     GridKey getKey(float x, float y, float z) const {
-        return {
-            (int)floorf(x / m_cellSize),
-            (int)floorf(y / m_cellSize),
-            (int)floorf(z / m_cellSize)
+        GridKey key{
+            (int)floorf(x * m_invCellSize),
+            (int)floorf(y * m_invCellSize),
+            (int)floorf(z * m_invCellSize)
         };
+        if (m_dense) {
+            key.x = clampAxis(key.x, 0);
+            key.y = clampAxis(key.y, 1);
+            key.z = clampAxis(key.z, 2);
+        }
+        return key;
+    }
+
+    int clampAxis(int c, int axis) const {
+        c -= m_lo[axis];
+        return c < 0 ? 0 : (c >= m_dims[axis] ? m_dims[axis] - 1 : c);
+    }
+
+    uint32_t denseIndex(int x, int y, int z) const {
+        return (uint32_t)((z * m_dims[1] + y) * m_dims[0] + x);
+    }
+
+    uint32_t findSlot(const GridKey& key) const {
+        // no table before the first build()
+        if (m_slotUsed.empty()) return EMPTY_SLOT;
+        uint32_t slot = hashKey(key) & m_slotMask;
+        while (m_slotUsed[slot]) {
+            if (m_slotKey[slot] == key) return slot;
+            slot = (slot + 1) & m_slotMask;
+        }
+        return EMPTY_SLOT;
+    }
+
+    uint32_t findOrAddSlot(const GridKey& key) {
+        uint32_t slot = hashKey(key) & m_slotMask;
+        while (m_slotUsed[slot]) {
+            if (m_slotKey[slot] == key) return slot;
+            slot = (slot + 1) & m_slotMask;
+        }
+        m_slotUsed[slot] = 1;
+        m_slotKey[slot] = key;
+        return slot;
+    }
+
+    uint32_t cellOf(const GridKey& key) const {
+        if (m_dense) return denseIndex(key.x, key.y, key.z);
+        return findSlot(key);
+    }
+
+    void link(uint32_t objectIndex, const GridKey& key) {
+        uint32_t cell = denseIndex(key.x, key.y, key.z);
+        uint32_t head = m_cellHead[cell];
+        m_objectKey[objectIndex] = key;
+        m_objectPrev[objectIndex] = EMPTY_SLOT;
+        m_objectNext[objectIndex] = head;
+        if (head != EMPTY_SLOT) m_objectPrev[head] = objectIndex;
+        m_cellHead[cell] = objectIndex;
+    }
+
+    void unlink(uint32_t objectIndex) {
+        uint32_t prev = m_objectPrev[objectIndex];
+        uint32_t next = m_objectNext[objectIndex];
+        if (prev != EMPTY_SLOT) m_objectNext[prev] = next;
+        else {
+            const GridKey& key = m_objectKey[objectIndex];
+            m_cellHead[denseIndex(key.x, key.y, key.z)] = next;
+        }
+        if (next != EMPTY_SLOT) m_objectPrev[next] = prev;
     }
 
 public:
-    SpatialGrid(float cellSize) : m_cellSize(cellSize) {}
+    SpatialGrid(float cellSize) : m_cellSize(cellSize), m_invCellSize(1.f / cellSize) {}
+
+    // Switches to dense mode over the box [min, max]
+    void setDenseBounds(float minX, float minY, float minZ, float maxX, float maxY, float maxZ) {
+        m_dense = true;
+        float min[3] = { minX, minY, minZ };
+        float max[3] = { maxX, maxY, maxZ };
+        for (int axis = 0; axis < 3; ++axis) {
+            m_lo[axis] = (int)floorf(min[axis] * m_invCellSize);
+            m_dims[axis] = (int)floorf(max[axis] * m_invCellSize) - m_lo[axis] + 1;
+        }
+    }
+
+    void setSparse() {
+        m_dense = false;
+        m_linked = false;
+    }
+
+    // Linked mode needs dense bounds to be set first. Switching modes empties the grid.
+    void setLinked(bool linked) {
+        m_linked = linked && m_dense;
+        clear();
+    }
+
+    inline float getCellSize() const { return m_cellSize; }
+    inline bool isDense() const { return m_dense; }
+    inline bool isLinked() const { return m_linked; }
 
     void clear() {
-        m_cells.clear();
+        m_entryObject.clear();
+        m_entryKey.clear();
+        if (m_linked) {
+            m_cellHead.assign((size_t)m_dims[0] * m_dims[1] * m_dims[2], EMPTY_SLOT);
+        }
     }
 
     void insert(uint32_t objectIndex, float x, float y, float z) {
-        GridKey key = getKey(x, y, z);
-        m_cells[key].push_back(objectIndex);
+        if (m_linked) {
+            if (objectIndex >= m_objectKey.size()) {
+                m_objectKey.resize(objectIndex + 1);
+                m_objectNext.resize(objectIndex + 1, EMPTY_SLOT);
+                m_objectPrev.resize(objectIndex + 1, EMPTY_SLOT);
+            }
+            link(objectIndex, getKey(x, y, z));
+            return;
+        }
+        m_entryObject.push_back(objectIndex);
+        m_entryKey.push_back(getKey(x, y, z));
+    }
+
+    // Linked mode: true once (x, y, z) is more than margin outside the object's cell
+    bool needsMove(uint32_t objectIndex, float x, float y, float z, float margin) const {
+        GridKey lo = getKey(x - margin, y - margin, z - margin);
+        GridKey hi = getKey(x + margin, y + margin, z + margin);
+        const GridKey& key = m_objectKey[objectIndex];
+        return key.x < lo.x || key.x > hi.x || key.y < lo.y || key.y > hi.y || key.z < lo.z || key.z > hi.z;
     }
 
-    void queryNeighbors(float x, float y, float z, std::vector<uint32_t>& results) {
+    // Linked mode: puts an inserted object into the cell of (x, y, z)
+    void move(uint32_t objectIndex, float x, float y, float z) {
+        unlink(objectIndex);
+        link(objectIndex, getKey(x, y, z));
+    }
+
+    // Counting sort of all inserted objects by cell. Linear in the number of objects (plus cells in dense mode).
+    void build() {
+        if (m_linked) return;
+        uint32_t count = (uint32_t)m_entryObject.size();
+        uint32_t cellCount;
+        m_entryCell.resize(count);
+
+        if (m_dense) {
+            cellCount = (uint32_t)(m_dims[0] * m_dims[1] * m_dims[2]);
+            for (uint32_t i = 0; i < count; ++i) {
+                const GridKey& key = m_entryKey[i];
+                m_entryCell[i] = denseIndex(key.x, key.y, key.z);
+            }
+        }
+        else {
+            // keep the load factor under one half
+            uint32_t capacity = 16;
+            while (capacity < count * 2) capacity <<= 1;
+            m_slotMask = capacity - 1;
+            m_slotKey.resize(capacity);
+            m_slotUsed.assign(capacity, 0);
+            cellCount = capacity;
+            for (uint32_t i = 0; i < count; ++i) {
+                m_entryCell[i] = findOrAddSlot(m_entryKey[i]);
+            }
+        }
+
+        m_cellStart.assign(cellCount + 1, 0);
+        for (uint32_t i = 0; i < count; ++i) {
+            ++m_cellStart[m_entryCell[i] + 1];
+        }
+        for (uint32_t c = 0; c < cellCount; ++c) {
+            m_cellStart[c + 1] += m_cellStart[c];
+        }
+        m_cellCursor.assign(m_cellStart.begin(), m_cellStart.end() - 1);
+        m_sortedObjects.resize(count);
+        // stable: objects keep their insertion order inside each cell
+        for (uint32_t i = 0; i < count; ++i) {
+            m_sortedObjects[m_cellCursor[m_entryCell[i]]++] = m_entryObject[i];
+        }
+    }
+
+    // Cells of the last build(), in dense index order in dense mode. Not for linked mode.
+    inline uint32_t getCellCount() const { return m_cellStart.empty() ? 0 : (uint32_t)m_cellStart.size() - 1; }
+
+    inline const uint32_t* getCellObjects(uint32_t cell, uint32_t& count) const {
+        count = m_cellStart[cell + 1] - m_cellStart[cell];
+        return m_sortedObjects.data() + m_cellStart[cell];
+    }
+
+    // Dense mode: box of a cell. Positions outside the dense bounds are clamped into the border
+    // cells, so the outer faces of those reach to infinity.
+    void getCellBounds(uint32_t cell, float min[3], float max[3]) const {
+        int key[3] = { (int)(cell % (uint32_t)m_dims[0]), (int)(cell / (uint32_t)m_dims[0] % (uint32_t)m_dims[1]),
+            (int)(cell / ((uint32_t)m_dims[0] * (uint32_t)m_dims[1])) };
+        for (int axis = 0; axis < 3; ++axis) {
+            min[axis] = key[axis] == 0 ? -HUGE_VALF : (float)(m_lo[axis] + key[axis]) * m_cellSize;
+            max[axis] = key[axis] == m_dims[axis] - 1 ? HUGE_VALF : (float)(m_lo[axis] + key[axis] + 1) * m_cellSize;
+        }
+    }
+
+    void queryNeighbors(float x, float y, float z, std::vector<uint32_t>& results) const {
         results.clear();
+        appendNeighbors(x, y, z, results);
+    }
+
+    // Same as queryNeighbors, without clearing results first
+    void appendNeighbors(float x, float y, float z, std::vector<uint32_t>& results) const {
+        // nothing built yet
+        if (!m_linked && m_cellStart.empty()) return;
         GridKey center = getKey(x, y, z);
 
         // Check 3x3x3 cube of cells around the object
@@ -52,13 +283,21 @@ public:
             for (int dy = -1; dy <= 1; dy++) {
                 for (int dz = -1; dz <= 1; dz++) {
                     GridKey key = { center.x + dx, center.y + dy, center.z + dz };
-                    auto it = m_cells.find(key);
-                    if (it != m_cells.end()) {
-                        const auto& objList = m_cells[key];
-						// this is faster than results.insert(results.end(), objList.begin(), objList.end());
-						for (int objIdx : objList) {
-                            results.push_back(objIdx);
+                    if (m_dense && (key.x < 0 || key.y < 0 || key.z < 0 ||
+                        key.x >= m_dims[0] || key.y >= m_dims[1] || key.z >= m_dims[2])) {
+                        continue;
+                    }
+                    uint32_t cell = cellOf(key);
+                    if (cell == EMPTY_SLOT) continue;
+                    if (m_linked) {
+                        for (uint32_t object = m_cellHead[cell]; object != EMPTY_SLOT; object = m_objectNext[object]) {
+                            results.push_back(object);
                         }
+                        continue;
+                    }
+                    // this is faster than results.insert(results.end(), begin, end);
+                    for (uint32_t k = m_cellStart[cell]; k < m_cellStart[cell + 1]; ++k) {
+                        results.push_back(m_sortedObjects[k]);
                     }
                 }
             }
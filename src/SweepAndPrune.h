@@ -0,0 +1,118 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// Sweep and prune broadphase on a single axis.
+// Objects are kept sorted by the lower endpoint of their box on the sweep axis. The order is
+// persistent between frames, so with coherent motion the insertion sort that restores it only
+// does a handful of swaps. The sweep then only looks at objects whose intervals overlap on the
+// sweep axis and checks the two remaining axes before reporting a pair.
+class SweepAndPrune {
+private:
+    struct Box {
+        float min[3];
+        float max[3];
+    };
+
+    std::vector<Box> m_boxes;      // by object index
+    std::vector<uint8_t> m_tracked; // by object index
+    std::vector<uint32_t> m_order; // tracked object indices, sorted by m_boxes[].min[m_axis]
+    int m_axis = 0;
+    bool m_needsFullSort = false;
+
+    void insertionSort() {
+        const int axis = m_axis;
+        for (size_t i = 1; i < m_order.size(); ++i) {
+            uint32_t object = m_order[i];
+            float key = m_boxes[object].min[axis];
+            size_t j = i;
+            while (j > 0 && m_boxes[m_order[j - 1]].min[axis] > key) {
+                m_order[j] = m_order[j - 1];
+                --j;
+            }
+            m_order[j] = object;
+        }
+    }
+
+public:
+    SweepAndPrune(int axis = 0) : m_axis(axis) {}
+
+    // Changing the axis throws the persistent order away
+    void setAxis(int axis) {
+        if (axis == m_axis) return;
+        m_axis = axis;
+        m_needsFullSort = true;
+    }
+
+    // Sets (and starts tracking) the box of an object for this frame
+    void setBox(uint32_t objectIndex, float minX, float minY, float minZ, float maxX, float maxY, float maxZ) {
+        if (objectIndex >= m_boxes.size()) {
+            m_boxes.resize(objectIndex + 1);
+            m_tracked.resize(objectIndex + 1, 0);
+        }
+        if (!m_tracked[objectIndex]) {
+            m_tracked[objectIndex] = 1;
+            m_order.push_back(objectIndex);
+            m_needsFullSort = true;
+        }
+        Box& box = m_boxes[objectIndex];
+        box.min[0] = minX; box.min[1] = minY; box.min[2] = minZ;
+        box.max[0] = maxX; box.max[1] = maxY; box.max[2] = maxZ;
+    }
+
+    // Renames every object to newIndex[object]. Boxes keep their place in the sort order.
+    void remap(const std::vector<uint32_t>& newIndex) {
+        std::vector<Box> boxes(newIndex.size());
+        std::vector<uint8_t> tracked(newIndex.size(), 0);
+        for (uint32_t object = 0; object < m_boxes.size(); ++object) {
+            boxes[newIndex[object]] = m_boxes[object];
+            tracked[newIndex[object]] = m_tracked[object];
+        }
+        m_boxes.swap(boxes);
+        m_tracked.swap(tracked);
+        for (uint32_t& object : m_order) {
+            object = newIndex[object];
+        }
+    }
+
+    void clear() {
+        m_boxes.clear();
+        m_tracked.clear();
+        m_order.clear();
+    }
+
+    // Restores the sort order and reports every overlapping pair as (lower index, higher index).
+    void findPairs(std::vector<std::pair<uint32_t, uint32_t>>& pairs) {
+        pairs.clear();
+        if (m_needsFullSort) {
+            // bulk insertions (spawning, axis change) would make the insertion sort quadratic
+            const int axis = m_axis;
+            std::sort(m_order.begin(), m_order.end(), [this, axis](uint32_t a, uint32_t b) {
+                return m_boxes[a].min[axis] < m_boxes[b].min[axis];
+            });
+            m_needsFullSort = false;
+        }
+        else {
+            insertionSort();
+        }
+
+        const int axis = m_axis;
+        const int axis1 = (axis + 1) % 3;
+        const int axis2 = (axis + 2) % 3;
+        const size_t count = m_order.size();
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t a = m_order[i];
+            const Box& boxA = m_boxes[a];
+            for (size_t k = i + 1; k < count; ++k) {
+                uint32_t b = m_order[k];
+                const Box& boxB = m_boxes[b];
+                if (boxB.min[axis] > boxA.max[axis]) break; // no later interval can overlap
+                if (boxA.max[axis1] < boxB.min[axis1] || boxB.max[axis1] < boxA.min[axis1]) continue;
+                if (boxA.max[axis2] < boxB.min[axis2] || boxB.max[axis2] < boxA.min[axis2]) continue;
+                pairs.emplace_back(std::min(a, b), std::max(a, b));
+            }
+        }
+    }
+};
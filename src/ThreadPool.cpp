@@ -0,0 +1,94 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+	start(threadCount);
+}
+
+ThreadPool::~ThreadPool() {
+	stop();
+}
+
+void ThreadPool::resize(uint32_t threadCount) {
+	stop();
+	start(threadCount);
+}
+
+void ThreadPool::start(uint32_t threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0) threadCount = 1;
+	}
+	m_stop = false;
+	m_generation = 0;
+	for (uint32_t i = 1; i < threadCount; ++i) {
+		m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+void ThreadPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+	m_workers.clear();
+}
+
+void ThreadPool::parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const RangeTask& task) {
+	if (begin >= end) return;
+	if (grainSize == 0) grainSize = 1;
+	// not worth waking anyone up
+	if (m_workers.empty() || end - begin <= grainSize) {
+		task(begin, end, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_begin = begin;
+		m_end = end;
+		m_grainSize = grainSize;
+		m_nextChunk.store(0, std::memory_order_relaxed);
+		m_busyWorkers = static_cast<uint32_t>(m_workers.size());
+		++m_generation;
+	}
+	m_wake.notify_all();
+
+	runChunks(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_busyWorkers == 0; });
+	m_task = nullptr;
+}
+
+void ThreadPool::runChunks(uint32_t threadIndex) {
+	const uint32_t chunkCount = (m_end - m_begin + m_grainSize - 1) / m_grainSize;
+	for (uint32_t chunk = m_nextChunk.fetch_add(1); chunk < chunkCount; chunk = m_nextChunk.fetch_add(1)) {
+		uint32_t chunkBegin = m_begin + chunk * m_grainSize;
+		uint32_t chunkEnd = chunkBegin + m_grainSize < m_end ? chunkBegin + m_grainSize : m_end;
+		(*m_task)(chunkBegin, chunkEnd, threadIndex);
+	}
+}
+
+void ThreadPool::workerLoop(uint32_t threadIndex) {
+	uint64_t seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this, seenGeneration] { return m_stop || m_generation != seenGeneration; });
+			if (m_stop) return;
+			seenGeneration = m_generation;
+		}
+
+		runChunks(threadIndex);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_busyWorkers == 0) {
+			m_done.notify_one();
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fixed size pool of worker threads for data parallel loops.
+- the calling thread takes part in every loop as thread index 0, workers are 1..n-1
+- chunks are handed out dynamically, so which thread runs a chunk is not deterministic.
+  Callers that need reproducible results write into per-thread buffers and sort/merge afterwards.
+*/
+class ThreadPool {
+public:
+	// begin, end, threadIndex
+	using RangeTask = std::function<void(uint32_t, uint32_t, uint32_t)>;
+
+	explicit ThreadPool(uint32_t threadCount = 0); // 0 = one thread per hardware thread
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void resize(uint32_t threadCount);
+	inline uint32_t getThreadCount() const { return static_cast<uint32_t>(m_workers.size()) + 1; }
+
+	// Runs task over [begin, end) in chunks of at most grainSize items and blocks until all are done.
+	void parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const RangeTask& task);
+
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	const RangeTask* m_task = nullptr;
+	uint32_t m_begin = 0;
+	uint32_t m_end = 0;
+	uint32_t m_grainSize = 1;
+	std::atomic<uint32_t> m_nextChunk{ 0 };
+	uint64_t m_generation = 0;
+	uint32_t m_busyWorkers = 0;
+	bool m_stop = false;
+
+	void start(uint32_t threadCount);
+	void stop();
+	void workerLoop(uint32_t threadIndex);
+	void runChunks(uint32_t threadIndex);
+};
@@ -0,0 +1,135 @@
+#include "Transforms.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define TRANSFORMS_SSE2
+#endif
+
+namespace Transforms {
+namespace {
+
+	// Round to nearest even. Values below the half range flush to zero, above it become infinity.
+	uint16_t FloatToHalf(float value) {
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		const uint32_t sign = (bits >> 16) & 0x8000u;
+		const int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFFu) - 127 + 15;
+		uint32_t mantissa = bits & 0x7FFFFFu;
+		if (exponent <= 0) return static_cast<uint16_t>(sign);
+		if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7C00u);
+		uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+		const uint32_t rest = mantissa & 0x1FFFu;
+		if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) ++half; // may carry into the exponent, which is still right
+		return static_cast<uint16_t>(sign | half);
+	}
+}
+
+	uint32_t PackScale(const glm::vec3& scale) {
+		return static_cast<uint32_t>(FloatToHalf(scale.x)) | (static_cast<uint32_t>(FloatToHalf(scale.y)) << 16);
+	}
+
+	uint32_t PackColor(const glm::vec4& color) {
+		uint32_t packed = 0;
+		for (int channel = 0; channel < 4; ++channel) {
+			float value = color[channel] < 0.f ? 0.f : (color[channel] > 1.f ? 1.f : color[channel]);
+			packed |= static_cast<uint32_t>(value * 255.f + .5f) << (8 * channel);
+		}
+		return packed;
+	}
+
+	void UpdateMatrices(const glm::mat4& viewProj, const BodyTransforms& bodies, uint32_t begin, uint32_t end, float alpha) {
+#if defined(TRANSFORMS_SSE2)
+		const __m128 vp0 = _mm_loadu_ps(&viewProj[0][0]);
+		const __m128 vp1 = _mm_loadu_ps(&viewProj[1][0]);
+		const __m128 vp2 = _mm_loadu_ps(&viewProj[2][0]);
+		const __m128 vp3 = _mm_loadu_ps(&viewProj[3][0]);
+#endif
+		for (uint32_t i = begin; i < end; ++i) {
+			// the same expression as the glm::vec3 interpolation it replaces
+			float c[3] = { bodies.pos[0][i], bodies.pos[1][i], bodies.pos[2][i] };
+			if (bodies.prev[0]) {
+				for (int axis = 0; axis < 3; ++axis) {
+					float previous = bodies.prev[axis][i];
+					c[axis] = previous + (c[axis] - previous) * alpha;
+				}
+			}
+			const glm::vec3& s = bodies.scale[i];
+			const float inv[3] = { 1.f / s.x, 1.f / s.y, 1.f / s.z };
+			objMatrices& matrices = bodies.matrices[i];
+#if defined(TRANSFORMS_SSE2)
+			const __m128 sx = _mm_set1_ps(s.x), sy = _mm_set1_ps(s.y), sz = _mm_set1_ps(s.z);
+			const __m128 cx = _mm_set1_ps(c[0]), cy = _mm_set1_ps(c[1]), cz = _mm_set1_ps(c[2]);
+
+			// model: diag(s) with the center in the last column
+			_mm_storeu_ps(&matrices.model[0][0], _mm_set_ps(0.f, 0.f, 0.f, s.x));
+			_mm_storeu_ps(&matrices.model[1][0], _mm_set_ps(0.f, 0.f, s.y, 0.f));
+			_mm_storeu_ps(&matrices.model[2][0], _mm_set_ps(0.f, s.z, 0.f, 0.f));
+			_mm_storeu_ps(&matrices.model[3][0], _mm_set_ps(1.f, c[2], c[1], c[0]));
+
+			// inverse transpose: 1 / s on the diagonal, -c / s in the last row
+			_mm_storeu_ps(&matrices.normalModel[0][0], _mm_set_ps(-(inv[0] * c[0]), 0.f, 0.f, inv[0]));
+			_mm_storeu_ps(&matrices.normalModel[1][0], _mm_set_ps(-(inv[1] * c[1]), 0.f, inv[1], 0.f));
+			_mm_storeu_ps(&matrices.normalModel[2][0], _mm_set_ps(-(inv[2] * c[2]), inv[2], 0.f, 0.f));
+
+			// viewProj * model, the last column summed in glm's order
+			_mm_storeu_ps(&matrices.mvp[0][0], _mm_mul_ps(vp0, sx));
+			_mm_storeu_ps(&matrices.mvp[1][0], _mm_mul_ps(vp1, sy));
+			_mm_storeu_ps(&matrices.mvp[2][0], _mm_mul_ps(vp2, sz));
+			_mm_storeu_ps(&matrices.mvp[3][0], _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vp0, cx), _mm_mul_ps(vp1, cy)), _mm_mul_ps(vp2, cz)), vp3));
+#else
+			matrices.model = glm::mat4{ 1.f };
+			matrices.normalModel = glm::mat3x4{ 1.f };
+			for (int axis = 0; axis < 3; ++axis) {
+				matrices.model[axis][axis] = s[axis];
+				matrices.model[3][axis] = c[axis];
+				matrices.normalModel[axis][axis] = inv[axis];
+				matrices.normalModel[axis][3] = -(inv[axis] * c[axis]);
+				matrices.mvp[axis] = viewProj[axis] * s[axis];
+			}
+			matrices.mvp[3] = viewProj[0] * c[0] + viewProj[1] * c[1] + viewProj[2] * c[2] + viewProj[3];
+#endif
+		}
+	}
+
+	void FrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]) {
+		// rows of the matrix, glm stores columns
+		glm::vec4 rows[4];
+		for (int row = 0; row < 4; ++row) {
+			rows[row] = glm::vec4(viewProj[0][row], viewProj[1][row], viewProj[2][row], viewProj[3][row]);
+		}
+		for (int axis = 0; axis < 3; ++axis) {
+			planes[2 * axis] = rows[3] + rows[axis];
+			planes[2 * axis + 1] = rows[3] - rows[axis];
+		}
+		for (int plane = 0; plane < 6; ++plane) {
+			glm::vec4& p = planes[plane];
+			float length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+			if (length > 0.f) p = p * (1.f / length);
+		}
+	}
+
+	FrustumTest TestBox(const glm::vec4 planes[6], const float min[3], const float max[3]) {
+		FrustumTest result = FRUSTUM_INSIDE;
+		for (int plane = 0; plane < 6; ++plane) {
+			const glm::vec4& p = planes[plane];
+			// corners furthest along and against the plane normal, zero components skipped so 0 * inf stays out
+			float farthest = p.w, nearest = p.w;
+			for (int axis = 0; axis < 3; ++axis) {
+				float n = p[axis];
+				if (n > 0.f) {
+					farthest += n * max[axis];
+					nearest += n * min[axis];
+				}
+				else if (n < 0.f) {
+					farthest += n * min[axis];
+					nearest += n * max[axis];
+				}
+			}
+			if (farthest < 0.f) return FRUSTUM_OUTSIDE;
+			if (nearest < 0.f) result = FRUSTUM_PARTIAL;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "Shape.h"
+#include <cstdint>
+
+/*
+Render matrices
+- every body is a translation plus an axis-aligned scale, so the model matrix is written
+  directly, its inverse transpose (the normal matrix) is the reciprocal scale with the
+  translation folded into the last row, and the MVP only needs the view projection columns
+  scaled by the body scale plus one column for the center. No general 4x4 inverse or product.
+- one body at a time with a matrix column per SSE register, writing straight into the
+  contiguous objMatrices array. The caller splits the bodies over threads.
+- model and MVP come out bit-identical to glm::translate/glm::scale and viewProj * model
+- the batch renderer skips all of it: it gets an InstanceData per body (center plus packed
+  scale) and a packed color, and its vertex shader rebuilds the matrices
+*/
+namespace Transforms {
+
+	// Read-only body arrays plus the matrices to write, all indexed by body
+	struct BodyTransforms {
+		const float* pos[3];
+		const float* prev[3]; // centers before the last physics step, null draws the bodies at pos
+		const glm::vec3* scale;
+		objMatrices* matrices;
+	};
+
+	// Matrices of the bodies [begin, end) at prev + (pos - prev) * alpha
+	void UpdateMatrices(const glm::mat4& viewProj, const BodyTransforms& bodies, uint32_t begin, uint32_t end, float alpha);
+
+	// Scale of InstanceData, every body is scaled the same on x and z
+	uint32_t PackScale(const glm::vec3& scale);
+	// RGBA8, red in the low byte
+	uint32_t PackColor(const glm::vec4& color);
+
+	// Left, right, bottom, top, near and far planes of an OpenGL clip space (z in [-w, w]),
+	// normalized so dot(xyz, p) + w is the signed distance, positive inside
+	void FrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]);
+
+	enum FrustumTest {
+		FRUSTUM_OUTSIDE,
+		FRUSTUM_PARTIAL, // crosses a plane, may still be outside near the frustum's edges
+		FRUSTUM_INSIDE
+	};
+	// Axis-aligned box against the planes, infinite bounds are allowed
+	FrustumTest TestBox(const glm::vec4 planes[6], const float min[3], const float max[3]);
+	inline bool SphereInFrustum(const glm::vec4 planes[6], const float center[3], float radius) {
+		for (int plane = 0; plane < 6; ++plane) {
+			const glm::vec4& p = planes[plane];
+			if (p.x * center[0] + p.y * center[1] + p.z * center[2] + p.w < -radius) return false;
+		}
+		return true;
+	}
+}
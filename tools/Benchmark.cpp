@@ -0,0 +1,318 @@
+#include "DynamicShapeArray.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+/*
+Microbenchmarks for the simulation core
+- every fixture is generated from a fixed seed, so runs are comparable across builds
+- sweeps body counts and densities (fraction of the enclosure volume covered by bodies)
+- writes one JSON document with every result, to stdout or to the file given with --out
+*/
+
+static const char* SHAPE_NAMES[] = { "cube", "sphere", "cylinder", "ring" };
+
+struct BenchmarkOptions {
+	uint32_t seed = 1337;
+	uint32_t threads = 0;
+	uint32_t iterations = 50;
+	bool quick = false;
+	std::string outPath;
+};
+
+struct BenchmarkResult {
+	std::string name;
+	uint32_t bodies;
+	float density;
+	uint64_t items; // work items per iteration (bodies, pairs, ...)
+	std::vector<double> samples; // ns per iteration
+	uint64_t output = 0; // what the last run produced (neighbors found, pairs hit), so the work can't be optimized out
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Runs fn a few times to warm up, then records one sample per iteration
+template<typename Fn>
+static std::vector<double> Measure(uint32_t iterations, Fn&& fn) {
+	for (uint32_t i = 0; i < 3; ++i) fn();
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (uint32_t i = 0; i < iterations; ++i) {
+		Clock::time_point start = Clock::now();
+		fn();
+		samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+	}
+	return samples;
+}
+
+// Enclosure cube and hero sphere like the app, plus count bodies of random type placed uniformly
+// in the enclosure. Their size is chosen so they cover density of its volume.
+static void BuildFixture(DynamicShapeArray& shapeArray, uint32_t count, float density, uint32_t seed) {
+	shapeArray.SetRandomSeed(seed);
+	shapeArray.InitFactoryPrototypes();
+	shapeArray.CreateShape(0.0f, 0.0f, 0.0f, 100.0f, T_CUBE);
+	shapeArray.CreateShape(35.0f, 35.0f, 35.0f, 30.0f, T_SPHERE);
+
+	std::mt19937 generator(seed);
+	float size = 100.f * std::cbrt(density / static_cast<float>(count));
+	size = std::clamp(size, 1.f, 10.f);
+	std::uniform_real_distribution<float> position(0.f, 100.f - size);
+	std::uniform_real_distribution<float> speed(0.f, .9f);
+	std::uniform_int_distribution<int> type(T_CUBE, T_RING);
+	for (uint32_t i = 0; i < count; ++i) {
+		// CreateShape takes the lower corner
+		shapeArray.CreateShape(position(generator), position(generator), position(generator), size, type(generator));
+		shapeArray.SetSpeed(i + 2, glm::vec3{ speed(generator), speed(generator), speed(generator) });
+	}
+}
+
+static void RunGridBenchmarks(const DynamicShapeArray& shapeArray, uint32_t count, float density,
+	const BenchmarkOptions& options, std::vector<BenchmarkResult>& results) {
+	const BodyStore& bodies = shapeArray.getBodies();
+	const uint32_t size = bodies.size();
+	SpatialGrid grid{ 10.0f };
+	grid.setDenseBounds(0.f, 0.f, 0.f, 100.f, 100.f, 100.f);
+
+	auto build = [&]() {
+		grid.clear();
+		for (uint32_t i = 2; i < size; ++i) {
+			grid.insert(i, bodies.posX[i] + bodies.velX[i], bodies.posY[i] + bodies.velY[i], bodies.posZ[i] + bodies.velZ[i]);
+		}
+		grid.build();
+	};
+	results.push_back({ "grid_insert", count, density, size - 2u, Measure(options.iterations, build) });
+
+	build();
+	std::vector<uint32_t> nearby;
+	uint64_t found = 0;
+	auto query = [&]() {
+		found = 0;
+		for (uint32_t i = 2; i < size; ++i) {
+			grid.queryNeighbors(bodies.posX[i] + bodies.velX[i], bodies.posY[i] + bodies.velY[i], bodies.posZ[i] + bodies.velZ[i], nearby);
+			found += nearby.size();
+		}
+	};
+	results.push_back({ "grid_query_neighbors", count, density, size - 2u, Measure(options.iterations, query) });
+	results.back().output = found;
+
+	// Hierarchical grid the simulation uses, every body on the level that fits its size
+	HierarchicalGrid hgrid{ 2.0f };
+	hgrid.setDenseBounds(0.f, 0.f, 0.f, 100.f, 100.f, 100.f);
+	std::vector<uint32_t> levels(size, 0);
+	auto hbuild = [&]() {
+		hgrid.clear();
+		for (uint32_t i = 2; i < size; ++i) {
+			levels[i] = hgrid.insert(i, bodies.posX[i] + bodies.velX[i], bodies.posY[i] + bodies.velY[i], bodies.posZ[i] + bodies.velZ[i], bodies.d[i]);
+		}
+		hgrid.build();
+	};
+	results.push_back({ "hgrid_insert", count, density, size - 2u, Measure(options.iterations, hbuild) });
+
+	hbuild();
+	auto hquery = [&]() {
+		uint32_t sameLevelCount;
+		found = 0;
+		for (uint32_t i = 2; i < size; ++i) {
+			hgrid.query(bodies.posX[i] + bodies.velX[i], bodies.posY[i] + bodies.velY[i], bodies.posZ[i] + bodies.velZ[i], levels[i], nearby, sameLevelCount);
+			found += nearby.size();
+		}
+	};
+	results.push_back({ "hgrid_query", count, density, size - 2u, Measure(options.iterations, hquery) });
+	results.back().output = found;
+}
+
+static void RunNarrowphaseBenchmarks(const DynamicShapeArray& shapeArray, uint32_t count, float density,
+	const BenchmarkOptions& options, std::vector<BenchmarkResult>& results) {
+	const BodyStore& bodies = shapeArray.getBodies();
+	const uint32_t size = bodies.size();
+
+	// Candidate pairs from the grid, split by unordered type pair
+	SpatialGrid grid{ 10.0f };
+	grid.setDenseBounds(0.f, 0.f, 0.f, 100.f, 100.f, 100.f);
+	for (uint32_t i = 2; i < size; ++i) {
+		grid.insert(i, bodies.posX[i] + bodies.velX[i], bodies.posY[i] + bodies.velY[i], bodies.posZ[i] + bodies.velZ[i]);
+	}
+	grid.build();
+	std::vector<std::pair<uint32_t, uint32_t>> pairs[4][4];
+	std::vector<uint32_t> nearby;
+	for (uint32_t i = 2; i < size; ++i) {
+		grid.queryNeighbors(bodies.posX[i] + bodies.velX[i], bodies.posY[i] + bodies.velY[i], bodies.posZ[i] + bodies.velZ[i], nearby);
+		for (uint32_t j : nearby) {
+			if (j <= i) continue;
+			int a = bodies.shapeType[i], b = bodies.shapeType[j];
+			pairs[std::min(a, b)][std::max(a, b)].emplace_back(i, j);
+		}
+	}
+
+	const NarrowPhase::BodyView view{ bodies.posX.data(), bodies.posY.data(), bodies.posZ.data(),
+		bodies.velX.data(), bodies.velY.data(), bodies.velZ.data(), bodies.d.data() };
+	for (int a = 0; a < 4; ++a) {
+		for (int b = a; b < 4; ++b) {
+			const std::vector<std::pair<uint32_t, uint32_t>>& candidates = pairs[a][b];
+			if (candidates.empty()) continue;
+			std::string pairName = std::string(SHAPE_NAMES[a]) + "_" + SHAPE_NAMES[b];
+
+			uint64_t hits = 0;
+			auto scalar = [&]() {
+				uint32_t first, second;
+				hits = 0;
+				for (const std::pair<uint32_t, uint32_t>& pair : candidates) {
+					hits += shapeArray.TestCollisionPair(pair.first, pair.second, first, second);
+				}
+			};
+			results.push_back({ "narrowphase_scalar_" + pairName, count, density, candidates.size(), Measure(options.iterations, scalar) });
+			results.back().output = hits;
+
+			bool swap;
+			NarrowPhase::PairKind kind = NarrowPhase::Classify(a, b, swap);
+			NarrowPhase::PairBatch batch;
+			for (const std::pair<uint32_t, uint32_t>& pair : candidates) {
+				NarrowPhase::Classify(bodies.shapeType[pair.first], bodies.shapeType[pair.second], swap);
+				if (swap) batch.push(pair.second, pair.first);
+				else batch.push(pair.first, pair.second);
+			}
+			auto batched = [&]() {
+				NarrowPhase::TestBatch(kind, view, batch);
+				hits = 0;
+				for (uint32_t word : batch.hitMask) hits += std::popcount(word);
+			};
+			results.push_back({ "narrowphase_batch_" + pairName, count, density, candidates.size(), Measure(options.iterations, batched) });
+			results.back().output = hits;
+		}
+	}
+}
+
+static void RunUpdateBenchmarks(DynamicShapeArray& shapeArray, uint32_t count, float density,
+	const BenchmarkOptions& options, std::vector<BenchmarkResult>& results) {
+	const uint32_t size = shapeArray.getSize();
+	glm::mat4 projection = glm::perspective(glm::radians(40.0f), 1.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(50.f, 50.f, 250.f), glm::vec3(50.f, 50.f, 50.f), glm::vec3(0.f, 1.f, 0.f));
+
+	results.push_back({ "update_matrices", count, density, size,
+		Measure(options.iterations, [&]() { shapeArray.UpdateMatrices(view, projection); }) });
+
+	std::vector<objMatrices> buffer(size);
+	results.push_back({ "upload_matrices", count, density, size, Measure(options.iterations, [&]() {
+		uint64_t offset = 0;
+		for (int type = T_CUBE; type <= T_RING; ++type) {
+			shapeArray.uploadMatricesToPtr(type, 0, buffer.data() + offset);
+			offset += shapeArray.getShapeTypeArraySize(type);
+		}
+	}) });
+
+	std::vector<InstanceData> instances(size);
+	results.push_back({ "upload_instances", count, density, size, Measure(options.iterations, [&]() {
+		uint64_t offset = 0;
+		for (int type = T_CUBE; type <= T_RING; ++type) {
+			shapeArray.uploadInstancesToPtr(type, instances.data() + offset, .5f);
+			offset += shapeArray.getShapeTypeArraySize(type);
+		}
+	}) });
+
+	// Last, since it moves the bodies
+	results.push_back({ "update_physics", count, density, size,
+		Measure(options.iterations, [&]() { shapeArray.UpdatePhysics(.016f); }) });
+}
+
+static void WriteJson(std::ostream& out, const BenchmarkOptions& options, uint32_t threadCount, const std::vector<BenchmarkResult>& results) {
+	out << "{\n"
+		<< "  \"seed\": " << options.seed << ",\n"
+		<< "  \"threads\": " << threadCount << ",\n"
+		<< "  \"simd_lanes\": " << NarrowPhase::GetLaneCount() << ",\n"
+		<< "  \"iterations\": " << options.iterations << ",\n"
+		<< "  \"results\": [\n";
+	for (size_t r = 0; r < results.size(); ++r) {
+		const BenchmarkResult& result = results[r];
+		std::vector<double> sorted = result.samples;
+		std::sort(sorted.begin(), sorted.end());
+		double mean = 0.0;
+		for (double sample : sorted) mean += sample;
+		mean /= sorted.size();
+		double median = sorted[sorted.size() / 2];
+		double perItem = result.items > 0 ? median / result.items : 0.0;
+		out << "    { \"name\": \"" << result.name << "\""
+			<< ", \"bodies\": " << result.bodies
+			<< ", \"density\": " << result.density
+			<< ", \"items\": " << result.items
+			<< ", \"median_ns\": " << median
+			<< ", \"mean_ns\": " << mean
+			<< ", \"min_ns\": " << sorted.front()
+			<< ", \"max_ns\": " << sorted.back()
+			<< ", \"ns_per_item\": " << perItem
+			<< ", \"output\": " << result.output
+			<< " }" << (r + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+static void PrintUsage() {
+	std::cout << "Usage: CollisionBenchmark [options]\n"
+		<< "  --out FILE        write the JSON results to FILE instead of stdout\n"
+		<< "  --seed N          fixture seed, default 1337\n"
+		<< "  --threads N       collision threads, 0 = one per hardware thread (default)\n"
+		<< "  --iterations N    samples per benchmark, default 50\n"
+		<< "  --quick           smallest body count and density only\n";
+}
+
+int main(int argc, char** argv) {
+	BenchmarkOptions options;
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (arg == "--out" && hasValue) options.outPath = argv[++i];
+			else if (arg == "--seed" && hasValue) options.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (arg == "--threads" && hasValue) options.threads = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (arg == "--iterations" && hasValue) options.iterations = static_cast<uint32_t>(std::stoul(argv[++i]));
+			else if (arg == "--quick") options.quick = true;
+			else {
+				PrintUsage();
+				return 1;
+			}
+		}
+	}
+	catch (const std::exception&) {
+		PrintUsage();
+		return 1;
+	}
+	if (options.iterations == 0) options.iterations = 1;
+
+	std::vector<uint32_t> bodyCounts = { 1000, 4000, 16000 };
+	std::vector<float> densities = { .02f, .1f, .3f };
+	if (options.quick) {
+		bodyCounts.resize(1);
+		densities.resize(1);
+	}
+
+	std::vector<BenchmarkResult> results;
+	uint32_t threadCount = 1;
+	for (uint32_t count : bodyCounts) {
+		for (float density : densities) {
+			std::cerr << "bodies " << count << ", density " << density << std::endl;
+			DynamicShapeArray shapeArray;
+			shapeArray.SetThreadCount(options.threads);
+			threadCount = shapeArray.getThreadCount();
+			BuildFixture(shapeArray, count, density, options.seed);
+			RunGridBenchmarks(shapeArray, count, density, options, results);
+			RunNarrowphaseBenchmarks(shapeArray, count, density, options, results);
+			RunUpdateBenchmarks(shapeArray, count, density, options, results);
+		}
+	}
+	if (options.outPath.empty()) {
+		WriteJson(std::cout, options, threadCount, results);
+	}
+	else {
+		std::ofstream file(options.outPath);
+		if (!file) {
+			std::cerr << "Could not open " << options.outPath << std::endl;
+			return 1;
+		}
+		WriteJson(file, options, threadCount, results);
+	}
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include "DynamicShapeArray.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+/*
+Headless simulation
+- builds the same scene as ApplicationController (enclosure cube, hero sphere, random bodies)
+  without a window or a renderer and steps it for a fixed number of frames
+- prints per frame timings so physics throughput can be measured on machines without a GPU
+- with --events a second thread drains the collision events while the simulation runs
+*/
+
+struct HeadlessOptions {
+	int bodies = 1000;
+	uint32_t frames = 1000;
+	float deltaTime = .016f;
+	uint32_t threads = 0;
+	BroadphaseType broadphase = BROADPHASE_GRID;
+	bool matrices = false;
+	float sleepTime = SLEEP_TIME;
+	int speedUp = 50;
+	bool continuous = false;
+	uint32_t reorderInterval = 0;
+	bool incrementalGrid = false;
+	bool events = false;
+};
+
+static void PrintUsage() {
+	std::cout << "Usage: CollisionHeadless [options]\n"
+		<< "  --bodies N        random bodies to spawn (rounded up to a cube number), default 1000\n"
+		<< "  --frames N        frames to simulate, default 1000\n"
+		<< "  --dt SECONDS      fixed frame time, default 0.016\n"
+		<< "  --threads N       collision threads, 0 = one per hardware thread (default)\n"
+		<< "  --broadphase NAME grid, sap or tree, default grid\n"
+		<< "  --matrices        also run UpdateMatrices every frame\n"
+		<< "  --sleep SECONDS   time below the sleep speed before a body sleeps, 0 disables sleeping\n"
+		<< "  --speedup N       speed modifier, 0 to 100, default 50\n"
+		<< "  --ccd             continuous collision detection\n"
+		<< "  --reorder N       sort bodies in Morton order every N frames, 0 disables (default)\n"
+		<< "  --incremental     keep the grid between frames and only move bodies that change cells\n"
+		<< "  --events          drain the collision events on a consumer thread and count them\n";
+}
+
+static bool ParseOptions(int argc, char** argv, HeadlessOptions& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--bodies" && hasValue) options.bodies = std::stoi(argv[++i]);
+		else if (arg == "--frames" && hasValue) options.frames = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--dt" && hasValue) options.deltaTime = std::stof(argv[++i]);
+		else if (arg == "--threads" && hasValue) options.threads = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--broadphase" && hasValue) {
+			std::string name = argv[++i];
+			if (name == "grid") options.broadphase = BROADPHASE_GRID;
+			else if (name == "sap") options.broadphase = BROADPHASE_SAP;
+			else if (name == "tree") options.broadphase = BROADPHASE_TREE;
+			else return false;
+		}
+		else if (arg == "--matrices") options.matrices = true;
+		else if (arg == "--sleep" && hasValue) options.sleepTime = std::stof(argv[++i]);
+		else if (arg == "--speedup" && hasValue) options.speedUp = std::stoi(argv[++i]);
+		else if (arg == "--ccd") options.continuous = true;
+		else if (arg == "--incremental") options.incrementalGrid = true;
+		else if (arg == "--events") options.events = true;
+		else if (arg == "--reorder" && hasValue) options.reorderInterval = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	HeadlessOptions options;
+	try {
+		if (!ParseOptions(argc, argv, options)) {
+			PrintUsage();
+			return 1;
+		}
+	}
+	catch (const std::exception&) {
+		PrintUsage();
+		return 1;
+	}
+
+	DynamicShapeArray shapeArray;
+	shapeArray.SetThreadCount(options.threads);
+	shapeArray.SetBroadphase(options.broadphase);
+	shapeArray.SetSleepParameters(SLEEP_SPEED, options.sleepTime);
+	shapeArray.SetSpeedUP(options.speedUp);
+	shapeArray.SetContinuousCollision(options.continuous);
+	shapeArray.SetReorderInterval(options.reorderInterval);
+	shapeArray.SetIncrementalGrid(options.incrementalGrid);
+	if (options.events) shapeArray.SetCollisionEventCapacity();
+	shapeArray.InitFactoryPrototypes();
+
+	// Same scene as ApplicationController::start
+	shapeArray.CreateShape(0.0f, 0.0f, 0.0f, 100.0f, T_CUBE);
+	shapeArray.CreateShape(35.0f, 35.0f, 35.0f, 30.0f, T_SPHERE);
+	shapeArray.CreateRandomShapes(options.bodies);
+
+	glm::mat4 projection = glm::perspective(glm::radians(40.0f), 1.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(50.f, 50.f, 250.f), glm::vec3(50.f, 50.f, 50.f), glm::vec3(0.f, 1.f, 0.f));
+
+	// Consumer: drains while the simulation runs, and once more after it stopped
+	std::atomic<bool> simulating{ true };
+	uint64_t eventCount = 0;
+	std::thread consumer;
+	if (options.events) {
+		consumer = std::thread([&shapeArray, &simulating, &eventCount]() {
+			std::vector<CollisionEvent> events;
+			bool running = true;
+			while (running) {
+				running = simulating.load(std::memory_order_acquire);
+				events.clear();
+				eventCount += shapeArray.getCollisionEvents().drain(events);
+				if (events.empty()) std::this_thread::yield();
+			}
+		});
+	}
+
+	using Clock = std::chrono::steady_clock;
+	double totalMs = 0.0, minMs = 1e30, maxMs = 0.0;
+	for (uint32_t frame = 0; frame < options.frames; ++frame) {
+		Clock::time_point start = Clock::now();
+		shapeArray.UpdatePhysics(options.deltaTime);
+		if (options.matrices) {
+			shapeArray.UpdateMatrices(view, projection);
+		}
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		totalMs += ms;
+		minMs = ms < minMs ? ms : minMs;
+		maxMs = ms > maxMs ? ms : maxMs;
+	}
+
+	simulating.store(false, std::memory_order_release);
+	if (consumer.joinable()) consumer.join();
+
+	uint32_t frames = options.frames > 0 ? options.frames : 1;
+	std::cout << "bodies:       " << shapeArray.getSize() << "\n"
+		<< "awake:        " << shapeArray.getAwakeCount() << "\n"
+		<< "frames:       " << options.frames << "\n"
+		<< "total:        " << totalMs << " ms\n"
+		<< "frame avg:    " << totalMs / frames << " ms\n"
+		<< "frame min:    " << (options.frames > 0 ? minMs : 0.0) << " ms\n"
+		<< "frame max:    " << maxMs << " ms\n"
+		<< "body steps/s: " << (totalMs > 0.0 ? shapeArray.getSize() * static_cast<double>(options.frames) / (totalMs * 1e-3) : 0.0) << std::endl;
+	if (options.events) {
+		std::cout << "events:       " << eventCount << " (" << shapeArray.getCollisionEvents().getDroppedCount() << " dropped in "
+			<< shapeArray.getCollisionEvents().getDroppedStepCount() << " steps)" << std::endl;
+	}
+	return 0;
+}